@@ -2,15 +2,31 @@
 #include "Project_SDL1.h"
 #include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
 #include <numeric>
-#include <random>
 #include <string>
 #include <map>
-void init()
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+void init(bool headless)
 {
-    if (SDL_Init(SDL_INIT_TIMER | SDL_INIT_VIDEO) < 0)
+    if (SDL_Init(headless ? SDL_INIT_TIMER : SDL_INIT_TIMER | SDL_INIT_VIDEO) < 0)
         throw std::runtime_error("init():" + std::string(SDL_GetError()));
+    if (headless)
+        return;
     int imgFlags = IMG_INIT_PNG;
     if (!(IMG_Init(imgFlags) & imgFlags))
         throw std::runtime_error("init(): SDL_image could not initialize! SDL_image Error: " + std::string(IMG_GetError()));
@@ -33,617 +49,2817 @@ namespace
         SDL_FreeSurface(loadedSurface);
         return optimizedSurface;
     }
+    // splitmix64 finalizer
+    uint64_t mixBits(uint64_t z)
+    {
+        z += 0x9E3779B97F4A7C15ull;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+    // Valeur d'une cellule pour getHash : les colonnes 32 bits comme avant les echeances 64 bits
+    uint64_t getColumnBits(int v) { return (uint32_t)v; }
+    uint64_t getColumnBits(uint32_t v) { return v; }
+    uint64_t getColumnBits(uint64_t v) { return v; }
+    // Toutes les colonnes d'une table, dans l'ordre des checkpoints
+    template <class F>
+    void forEachColumn(speciesTable& pTable, F f)
+    {
+        f(pTable.id_);
+        f(pTable.x_);
+        f(pTable.y_);
+        f(pTable.xVelocity_);
+        f(pTable.yVelocity_);
+        f(pTable.properties_);
+        f(pTable.cooldown_);
+        f(pTable.boostTime_);
+        f(pTable.procreateTime_);
+        f(pTable.lifeTime_);
+        f(pTable.xTarget_);
+        f(pTable.yTarget_);
+        f(pTable.prey_);
+        f(pTable.preyBand_);
+        f(pTable.draws_);
+    }
+    // Les vues pIndices d'une table dont l'espece est T : appels directs, inlinables
+    template <class T>
+    void updateViews(speciesTable& pTable, const std::vector<int>& pIndices, spriteBatch& batch)
+    {
+        for (int i : pIndices)
+            static_cast<T*>(pTable.views_[i])->update(pTable, i, batch);
+    }
+    // Hitbox de voisins rangees en colonnes, et leur distance au carre a (x, y)
+    struct candidateBlock
+    {
+        std::vector<int> x_;
+        std::vector<int> y_;
+        std::vector<int> distance_;
+
+        void measure(speciesTable& pTable, const std::vector<int>& pIndices, int x, int y)
+        {
+            int n = (int)pIndices.size();
+            this->x_.resize(n);
+            this->y_.resize(n);
+            this->distance_.resize(n);
+            for (int k = 0; k < n; k++)
+            {
+                this->x_[k] = pTable.getXBox(pIndices[k]);
+                this->y_[k] = pTable.getYBox(pIndices[k]);
+            }
+            distanceKernel::squaredDistances(x, y, this->x_.data(), this->y_.data(), n, pTable.getWidthBox(), pTable.getHeightBox(), this->distance_.data());
+        }
+    };
 } // namespace
 
+void simulationParams::validate() const
+{
+    //Un objet ne doit pas parcourir plus de grid_slack en un tick (voir spatialGrid)
+    for (int vVelocity : { this->sheepVelocity, this->wolfVelocity, this->dogVelocity, this->shepherdVelocity })
+        if (vVelocity < 1 || vVelocity + 2 * this->boostSpeed > grid_slack)
+            throw std::runtime_error("Velocities must be in [1, " + std::to_string(grid_slack - 2 * this->boostSpeed) + "]\n");
+    if (this->boostSpeed < 0 || this->wolfLifeTime < 1 || this->boostCooldown < 0 || this->boostTime < 0 || this->procreateTime < 0)
+        throw std::runtime_error("Times and boost speed must be positive\n");
+    if (this->dogScareDistance < 0 || this->wolfFleeDistance < 0 || this->dogFollowDistance < 0)
+        throw std::runtime_error("Distances must be positive\n");
+    //Le plus grand sprite doit tenir, et les distances au carre dans 32 bits
+    if (this->worldWidth < 256 || this->worldHeight < 256 || this->worldWidth > world_max_size || this->worldHeight > world_max_size)
+        throw std::runtime_error("World size must be in [256, " + std::to_string(world_max_size) + "]\n");
+    if (this->lodPeriod < 1 || this->lodPeriod > lod_max_period)
+        throw std::runtime_error("LOD period must be in [1, " + std::to_string(lod_max_period) + "]\n");
+}
+/////////////////////////////////////////////
+uint32_t counterRandom(uint64_t seed, uint64_t id, uint64_t tick, uint64_t counter)
+{
+    //31 bits, comme rand()
+    return (uint32_t)(mixBits(mixBits(mixBits(mixBits(seed) ^ id) ^ tick) ^ counter) >> 33);
+}
+
+//*****************************************************************************
+// ******************************* SPRITE ATLAS *******************************
+//*****************************************************************************
+std::map<std::string, SDL_Surface*> spriteAtlas::surfaces_ = {};
+std::map<std::string, animationTable> spriteAtlas::animations_ = {};
+/////////////////////////////////////////////
+SDL_Surface* spriteAtlas::getSurface(const std::string& path, SDL_Surface* window_surface_ptr)
+{
+    std::map<std::string, SDL_Surface*>::iterator it = spriteAtlas::surfaces_.find(path);
+    if (it != spriteAtlas::surfaces_.end())
+        return it->second;
+    SDL_Surface* vSurface = load_surface_for(path, window_surface_ptr);
+    spriteAtlas::surfaces_.insert({ path, vSurface });
+    return vSurface;
+}
+/////////////////////////////////////////////
+const animationTable* spriteAtlas::addAnimations(const std::string& name, const std::vector<std::vector<std::string>>& paths, int frameInterval, SDL_Surface* window_surface_ptr)
+{
+    std::map<std::string, animationTable>::iterator it = spriteAtlas::animations_.find(name);
+    if (it != spriteAtlas::animations_.end())
+        return &it->second;
+    assert(paths.size() == static_cast<size_t>(direction::count));
+    animationTable vTable;
+    vTable.frameCount_ = (int)paths[0].size();
+    vTable.frameInterval_ = frameInterval;
+    for (const std::vector<std::string>& vPaths : paths)
+    {
+        assert((int)vPaths.size() == vTable.frameCount_);
+        for (const std::string& vPath : vPaths)
+            vTable.frames_.push_back(spriteAtlas::getSurface(vPath, window_surface_ptr));
+    }
+    return &(spriteAtlas::animations_[name] = vTable);
+}
+/////////////////////////////////////////////
+void spriteAtlas::release()
+{
+    for (const auto& it : spriteAtlas::surfaces_)
+        SDL_FreeSurface(it.second);
+    spriteAtlas::surfaces_.clear();
+    spriteAtlas::animations_.clear();
+}
+/////////////////////////////////////////////
+direction getDirection(int xVelocity, int yVelocity)
+{
+    //Vitesse nulle sur un axe : meme choix que les anciennes cles "sw", "se", "nw", "ne"
+    if (xVelocity <= 0 && yVelocity >= 0) { return direction::sw; }
+    if (xVelocity >= 0 && yVelocity >= 0) { return direction::se; }
+    if (xVelocity <= 0 && yVelocity <= 0) { return direction::nw; }
+    return direction::ne;
+}
+
+//*****************************************************************************
+// ******************************** THREAD POOL *******************************
+//*****************************************************************************
+thread_local int threadPool::worker_ = 0;
+/////////////////////////////////////////////
+threadPool::threadPool(int nThreads):
+    nextChunk_{0}
+{
+    if (nThreads <= 0)
+        nThreads = std::max(1u, std::thread::hardware_concurrency());
+    this->jobSize_ = 0;
+    this->chunkSize_ = 1;
+    this->pending_ = 0;
+    this->generation_ = 0;
+    this->stop_ = false;
+    for (int i = 1; i < nThreads; i++)
+        this->workers_.push_back(std::thread(&threadPool::work, this, i));
+}
+/////////////////////////////////////////////
+threadPool::~threadPool()
+{
+    {
+        std::lock_guard<std::mutex> vLock(this->mutex_);
+        this->stop_ = true;
+    }
+    this->start_.notify_all();
+    for (std::thread& vWorker : this->workers_)
+        vWorker.join();
+}
+/////////////////////////////////////////////
+int threadPool::getThreadCount() { return (int)this->workers_.size() + 1; }
+/////////////////////////////////////////////
+int threadPool::getWorker() { return worker_; }
+/////////////////////////////////////////////
+void threadPool::work(int worker)
+{
+    unsigned vGeneration = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> vLock(this->mutex_);
+            this->start_.wait(vLock, [&] { return this->stop_ || this->generation_ != vGeneration; });
+            if (this->stop_)
+                return;
+            vGeneration = this->generation_;
+        }
+        this->runChunks(worker);
+        std::lock_guard<std::mutex> vLock(this->mutex_);
+        if (--this->pending_ == 0)
+            this->done_.notify_one();
+    }
+}
+/////////////////////////////////////////////
+void threadPool::runChunks(int worker)
+{
+    //Chaque thread prend le prochain morceau libre jusqu'a epuisement
+    worker_ = worker;
+    while (true)
+    {
+        int vBegin = this->nextChunk_.fetch_add(this->chunkSize_);
+        if (vBegin >= this->jobSize_)
+            return;
+        this->job_(vBegin, std::min(this->jobSize_, vBegin + this->chunkSize_));
+    }
+}
+/////////////////////////////////////////////
+void threadPool::parallelFor(int n, const std::function<void(int begin, int end)>& job, int minChunk)
+{
+    if (n <= 0)
+        return;
+    if (this->workers_.empty())
+    {
+        worker_ = 0;
+        job(0, n);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> vLock(this->mutex_);
+        this->job_ = job;
+        this->jobSize_ = n;
+        //Assez de morceaux pour equilibrer, assez gros pour amortir l'atomique
+        this->chunkSize_ = std::max(minChunk, n / (this->getThreadCount() * 8));
+        this->nextChunk_ = 0;
+        this->pending_ = (int)this->workers_.size();
+        this->generation_++;
+    }
+    this->start_.notify_all();
+    this->runChunks(0);
+    std::unique_lock<std::mutex> vLock(this->mutex_);
+    this->done_.wait(vLock, [&] { return this->pending_ == 0; });
+}
+//*****************************************************************************
+// ********************************** PROFILER ********************************
+//*****************************************************************************
+#ifdef WOLFSHEEP_PROFILE
+std::vector<profiler::phase> profiler::phases_ = {};
+std::vector<profiler::traceEvent> profiler::events_ = {};
+std::string profiler::traceFile_ = "";
+std::chrono::steady_clock::time_point profiler::origin_ = std::chrono::steady_clock::now();
+
+int profiler::getBucket(uint64_t ns)
+{
+    //Exact sous 64 ns, puis 32 buckets par puissance de deux
+    if (ns < 64)
+        return (int)ns;
+    int vShift = 1;
+    while ((ns >> vShift) >= 64)
+        vShift++;
+    return std::min(profile_buckets - 1, 32 * vShift + (int)(ns >> vShift));
+}
+/////////////////////////////////////////////
+uint64_t profiler::getBucketValue(int bucket)
+{
+    if (bucket < 64)
+        return bucket;
+    int vShift = bucket / 32 - 1;
+    return (uint64_t)(bucket - 32 * vShift) << vShift;
+}
+/////////////////////////////////////////////
+uint64_t profiler::getPercentile(const phase& pPhase, double percentile)
+{
+    uint64_t vRank = (uint64_t)std::ceil(pPhase.count_ * percentile);
+    uint64_t vSeen = 0;
+    for (int b = 0; b < profile_buckets; b++)
+    {
+        vSeen += pPhase.histogram_[b];
+        if (vSeen >= vRank && vSeen > 0)
+            return std::min(pPhase.max_, getBucketValue(b));
+    }
+    return pPhase.max_;
+}
+/////////////////////////////////////////////
+int profiler::getPhase(const std::string& name)
+{
+    for (int p = 0; p < (int)phases_.size(); p++)
+        if (phases_[p].name_ == name)
+            return p;
+    phases_.push_back({ name, std::vector<uint32_t>(profile_buckets, 0), 0, 0 });
+    return (int)phases_.size() - 1;
+}
+/////////////////////////////////////////////
+void profiler::record(int pPhase, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+{
+    uint64_t vNs = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    phase& vPhase = phases_[pPhase];
+    vPhase.histogram_[getBucket(vNs)]++;
+    vPhase.count_++;
+    vPhase.max_ = std::max(vPhase.max_, vNs);
+    if (!traceFile_.empty() && events_.size() < profile_max_events)
+        events_.push_back({ pPhase, (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(start - origin_).count(), vNs });
+}
+/////////////////////////////////////////////
+void profiler::setTraceFile(const std::string& path)
+{
+    traceFile_ = path;
+    events_.reserve(std::min<size_t>(profile_max_events, 1 << 16));
+}
+/////////////////////////////////////////////
+void profiler::report()
+{
+    printf("\n%-26s %10s %12s %12s %12s\n", "Phase", "count", "p50 (us)", "p99 (us)", "max (us)");
+    for (const phase& vPhase : phases_)
+        printf("%-26s %10llu %12.1f %12.1f %12.1f\n", vPhase.name_.c_str(), (unsigned long long)vPhase.count_,
+               getPercentile(vPhase, 0.5) / 1000., getPercentile(vPhase, 0.99) / 1000., vPhase.max_ / 1000.);
+    if (traceFile_.empty())
+        return;
+    //Format trace_event de Chrome (chrome://tracing, Perfetto) : evenements complets "X" en microsecondes
+    std::ofstream vTrace(traceFile_);
+    if (!vTrace)
+        throw std::runtime_error("Can't write trace " + traceFile_ + "\n");
+    vTrace << "{\"traceEvents\":[\n";
+    for (size_t e = 0; e < events_.size(); e++)
+    {
+        char vLine[256];
+        snprintf(vLine, sizeof(vLine), "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":1}%s\n",
+                 phases_[events_[e].phase_].name_.c_str(), events_[e].start_ / 1000., events_[e].duration_ / 1000.,
+                 e + 1 < events_.size() ? "," : "");
+        vTrace << vLine;
+    }
+    vTrace << "],\"displayTimeUnit\":\"ms\"}\n";
+    printf("Trace : %s (%zu events%s)\n", traceFile_.c_str(), events_.size(), events_.size() >= profile_max_events ? ", truncated" : "");
+}
+#endif
+//*****************************************************************************
+// ******************************* SPECIES TABLE ******************************
+//*****************************************************************************
+speciesTable::speciesTable(int width, int height, int totalVelocity)
+{
+    this->width_ = width;
+    this->height_ = height;
+    this->totalVelocity_ = totalVelocity;
+    this->worldWidth_ = frame_width;
+    this->worldHeight_ = frame_height;
+    this->seed_ = 0;
+    this->tick_ = 0;
+}
+/////////////////////////////////////////////
+int speciesTable::size() { return (int)this->x_.size(); }
+/////////////////////////////////////////////
+int speciesTable::add(uint32_t id, int x, int y, uint32_t properties, renderedObject* view)
+{
+    int i = this->size();
+    this->id_.push_back(id);
+    this->x_.push_back(x);
+    this->y_.push_back(y);
+    this->xVelocity_.push_back(0);
+    this->yVelocity_.push_back(0);
+    this->properties_.push_back(properties);
+    this->cooldown_.push_back(0);
+    this->boostTime_.push_back(0);
+    this->procreateTime_.push_back(0);
+    this->lifeTime_.push_back(0);
+    this->xTarget_.push_back(0);
+    this->yTarget_.push_back(0);
+    this->prey_.push_back(no_prey);
+    this->preyBand_.push_back(0);
+    this->draws_.push_back(0);
+    this->views_.push_back(view);
+    this->frame_.push_back(0);
+    this->frameWait_.push_back(0);
+    return i;
+}
+/////////////////////////////////////////////
+void speciesTable::copyEntity(int from, int to)
+{
+    this->id_[to] = this->id_[from];
+    this->x_[to] = this->x_[from];
+    this->y_[to] = this->y_[from];
+    this->xVelocity_[to] = this->xVelocity_[from];
+    this->yVelocity_[to] = this->yVelocity_[from];
+    this->properties_[to] = this->properties_[from];
+    this->cooldown_[to] = this->cooldown_[from];
+    this->boostTime_[to] = this->boostTime_[from];
+    this->procreateTime_[to] = this->procreateTime_[from];
+    this->lifeTime_[to] = this->lifeTime_[from];
+    this->xTarget_[to] = this->xTarget_[from];
+    this->yTarget_[to] = this->yTarget_[from];
+    this->prey_[to] = this->prey_[from];
+    this->preyBand_[to] = this->preyBand_[from];
+    this->draws_[to] = this->draws_[from];
+    this->views_[to] = this->views_[from];
+    this->frame_[to] = this->frame_[from];
+    this->frameWait_[to] = this->frameWait_[from];
+}
+/////////////////////////////////////////////
+void speciesTable::removeDeads()
+{
+    //Une seule passe quel que soit le nombre de morts, les vues retournent a leur pool
+    int n = 0;
+    for (int i = 0; i < this->size(); i++)
+    {
+        if (this->hasPropertie(i, propertie::dead))
+        {
+            delete this->views_[i];
+            continue;
+        }
+        if (n != i)
+            this->copyEntity(i, n);
+        n++;
+    }
+    this->id_.resize(n);
+    this->x_.resize(n);
+    this->y_.resize(n);
+    this->xVelocity_.resize(n);
+    this->yVelocity_.resize(n);
+    this->properties_.resize(n);
+    this->cooldown_.resize(n);
+    this->boostTime_.resize(n);
+    this->procreateTime_.resize(n);
+    this->lifeTime_.resize(n);
+    this->xTarget_.resize(n);
+    this->yTarget_.resize(n);
+    this->prey_.resize(n);
+    this->preyBand_.resize(n);
+    this->draws_.resize(n);
+    this->views_.resize(n);
+    this->frame_.resize(n);
+    this->frameWait_.resize(n);
+}
+/////////////////////////////////////////////
+int speciesTable::findId(uint32_t id)
+{
+    //Les naissances ajoutent des id_ croissants a la fin, removeDeads garde l'ordre
+    std::vector<uint32_t>::iterator it = std::lower_bound(this->id_.begin(), this->id_.end(), id);
+    if (it == this->id_.end() || *it != id)
+        return -1;
+    return (int)(it - this->id_.begin());
+}
+/////////////////////////////////////////////
+void speciesTable::addPropertie(int i, propertie pPropertie)
+{
+    this->properties_[i] |= propertieBit(pPropertie);
+}
+/////////////////////////////////////////////
+bool speciesTable::hasPropertie(int i, propertie pPropertie)
+{
+    return (this->properties_[i] & propertieBit(pPropertie)) != 0;
+}
+/////////////////////////////////////////////
+bool speciesTable::removePropertie(int i, propertie pPropertie)
+{
+    bool vHad = this->hasPropertie(i, pPropertie);
+    this->properties_[i] &= ~propertieBit(pPropertie);
+    return vHad;
+}
+/////////////////////////////////////////////
+int speciesTable::getHeightBox() { return this->height_ * 4 / 5 ; }
+int speciesTable::getWidthBox() { return this->width_/ 2 ; }
+int speciesTable::getXBox(int i) { return this->x_[i] + (this->width_ - this->getWidthBox()) / 2; }
+int speciesTable::getYBox(int i) { return this->y_[i] + (this->height_ - this->getHeightBox()) / 2;}
+/////////////////////////////////////////////
+int speciesTable::getDistance(int i, speciesTable& pTable2, int j)
+{ 
+    int xDistance = std::min(abs(this->getXBox(i) - pTable2.getXBox(j)), abs(this->getXBox(i) - pTable2.getXBox(j) - pTable2.getWidthBox()));
+    int yDistance = std::min(abs(this->getYBox(i) - pTable2.getYBox(j)), abs(this->getYBox(i) - pTable2.getYBox(j) - pTable2.getHeightBox()));
+    return std::sqrt(xDistance*xDistance + yDistance*yDistance);
+}
+/////////////////////////////////////////////
+int speciesTable::getSquaredDistance(int i, speciesTable& pTable2, int j)
+{
+    int xDistance = std::min(abs(this->getXBox(i) - pTable2.getXBox(j)), abs(this->getXBox(i) - pTable2.getXBox(j) - pTable2.getWidthBox()));
+    int yDistance = std::min(abs(this->getYBox(i) - pTable2.getYBox(j)), abs(this->getYBox(i) - pTable2.getYBox(j) - pTable2.getHeightBox()));
+    return xDistance * xDistance + yDistance * yDistance;
+}
+/////////////////////////////////////////////
+bool speciesTable::theresOverlap(int i, speciesTable& pTable2, int j)
+{
+    return!((this->getXBox(i) > pTable2.getXBox(j) + pTable2.getWidthBox())
+         || (this->getXBox(i) + this->getWidthBox() < pTable2.getXBox(j))
+         || (this->getYBox(i) > pTable2.getYBox(j) + pTable2.getHeightBox())
+         || (this->getYBox(i) + this->getHeightBox() < pTable2.getYBox(j)));
+}
+/////////////////////////////////////////////
+bool speciesTable::hasInside(int i, int x, int y)
+{
+    return (this->x_[i] <= x) && (this->x_[i] + this->width_ >= x)
+        && (this->y_[i] <= y) && (this->y_[i] + this->height_ >= y);
+}
+/////////////////////////////////////////////
+bool speciesTable::canMoveX(int i) { return (this->getXBox(i) + this->xVelocity_[i] + this->getWidthBox() < this->worldWidth_) && (this->getXBox(i) + this->xVelocity_[i] > 0); }
+bool speciesTable::canMoveY(int i) { return (this->getYBox(i) + this->yVelocity_[i] + this->getHeightBox() < this->worldHeight_) && (this->getYBox(i) + this->yVelocity_[i] > 0); }
+/////////////////////////////////////////////
+void speciesTable::goToward(int i, int x, int y)
+{
+    this->xVelocity_[i] = x - this->getXBox(i);
+    this->yVelocity_[i] = y - this->getYBox(i);
+    this->adjustVelocitys(i);
+}
+/////////////////////////////////////////////
+void speciesTable::runAway(int i, int x, int y)
+{
+    this->xVelocity_[i] = this->getXBox(i) - x;
+    this->yVelocity_[i] = this->getYBox(i) - y;
+    this->adjustVelocitys(i);
+}
+/////////////////////////////////////////////
+uint32_t speciesTable::random(int i)
+{
+    return counterRandom(this->seed_, this->id_[i], this->tick_, this->draws_[i]++);
+}
+/////////////////////////////////////////////
+void speciesTable::setRandomVelocitys(int i)
+{
+    this->xVelocity_[i] = (this->random(i) % this->totalVelocity_ * 2) - this->totalVelocity_;
+    if (!canMoveX(i))
+        this->xVelocity_[i] = -this->xVelocity_[i];
+    this->yVelocity_[i] = (((this->random(i) % 1) * 2) - 1) * (this->totalVelocity_ - abs(this->xVelocity_[i]));
+    if (!canMoveY(i))
+        this->yVelocity_[i] = -this->yVelocity_[i];
+}
+/////////////////////////////////////////////
+void speciesTable::adjustVelocitys(int i)
+{
+    int& vX = this->xVelocity_[i];
+    int& vY = this->yVelocity_[i];
+    //Hors map
+    while (!canMoveX(i) && vX != 0)
+        vX -= (vX > 0 ? 1 : -1);
+    while (!canMoveY(i) && vY != 0)
+        vY -= (vY > 0 ? 1 : -1);
+    //Vitesse trop élevé
+    while (abs(vX) + abs(vY) > abs(this->totalVelocity_))
+    {
+        vX -= (vX > 0 ? 1 : -1);
+        if (abs(vX) + abs(vY) > abs(this->totalVelocity_))
+            vY -= (vY > 0 ? 1 : -1);
+    }
+    //Vitesse trop faible
+    if (abs(vX) + abs(vY) < abs(this->totalVelocity_))
+        this->setRandomVelocitys(i);
+}
+/////////////////////////////////////////////
+void speciesTable::move(int i)
+{ 
+    if (!canMoveX(i) || !canMoveY(i))
+        this->setRandomVelocitys(i);
+    this->x_[i] += this->xVelocity_[i];
+    this->y_[i] += this->yVelocity_[i];
+}
+//*****************************************************************************
+// ******************************* ENTITY STORE *******************************
+//*****************************************************************************
+entityStore::entityStore():
+    sheeps_(sheep::ImgW, sheep::ImgH, 3),
+    wolves_(wolf::ImgW, wolf::ImgH, 3),
+    dogs_(dog::ImgW, dog::ImgH, 3),
+    shepherds_(shepherd::ImgW, shepherd::ImgH, 4)
+{
+    this->nextId_ = 0;
+}
+/////////////////////////////////////////////
+void entityStore::setSeed(uint64_t seed)
+{
+    for (speciesTable* vTable : { &this->sheeps_, &this->wolves_, &this->dogs_, &this->shepherds_ })
+        vTable->seed_ = seed;
+}
+/////////////////////////////////////////////
+void entityStore::setWorld(int width, int height)
+{
+    for (speciesTable* vTable : { &this->sheeps_, &this->wolves_, &this->dogs_, &this->shepherds_ })
+    {
+        vTable->worldWidth_ = width;
+        vTable->worldHeight_ = height;
+    }
+}
+/////////////////////////////////////////////
+void entityStore::nextTick()
+{
+    for (speciesTable* vTable : { &this->sheeps_, &this->wolves_, &this->dogs_, &this->shepherds_ })
+    {
+        vTable->tick_++;
+        std::fill(vTable->draws_.begin(), vTable->draws_.end(), 0);
+    }
+}
+/////////////////////////////////////////////
+void entityStore::removeDeads()
+{
+    this->sheeps_.removeDeads();
+    this->wolves_.removeDeads();
+    this->dogs_.removeDeads();
+    this->shepherds_.removeDeads();
+}
+/////////////////////////////////////////////
+uint64_t entityStore::getHash()
+{
+    uint64_t vHash = mixBits(this->nextId_);
+    for (speciesTable* vTable : { &this->sheeps_, &this->wolves_, &this->dogs_, &this->shepherds_ })
+    {
+        vHash = mixBits(vHash ^ vTable->tick_ ^ ((uint64_t)vTable->size() << 32));
+        forEachColumn(*vTable, [&](auto& vColumn) {
+            for (auto v : vColumn)
+                vHash = mixBits(vHash ^ getColumnBits(v));
+        });
+    }
+    return vHash;
+}
+/////////////////////////////////////////////
+void entityStore::deleteViews()
+{
+    for (speciesTable* vTable : { &this->sheeps_, &this->wolves_, &this->dogs_, &this->shepherds_ })
+        for (renderedObject* vView : vTable->views_)
+            delete vView;
+}
+//*****************************************************************************
+// ******************************* SPRITE BATCH *******************************
+//*****************************************************************************
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define WOLFSHEEP_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define WOLFSHEEP_TARGET(isa)
+#else
+#define WOLFSHEEP_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+namespace
+{
+    // Une ligne de sprite a cle de couleur, comme SDL (BlitNtoNKey, 4 octets, memes masques) :
+    // transparent si (pixel & keyMask) == key, sinon dst = (pixel & keepMask) | setBits
+    struct keyLine
+    {
+        Uint32 key;
+        Uint32 keyMask;
+        Uint32 keepMask;
+        Uint32 setBits;
+    };
+
+    void blitKeyScalar(const Uint32* src, Uint32* dst, int n, const keyLine& k)
+    {
+        for (int x = 0; x < n; x++)
+            if ((src[x] & k.keyMask) != k.key)
+                dst[x] = (src[x] & k.keepMask) | k.setBits;
+    }
+#ifdef WOLFSHEEP_X86
+    WOLFSHEEP_TARGET("sse2")
+    void blitKeySSE2(const Uint32* src, Uint32* dst, int n, const keyLine& k)
+    {
+        const __m128i vKey = _mm_set1_epi32((int)k.key);
+        const __m128i vKeyMask = _mm_set1_epi32((int)k.keyMask);
+        const __m128i vKeep = _mm_set1_epi32((int)k.keepMask);
+        const __m128i vSet = _mm_set1_epi32((int)k.setBits);
+        int x = 0;
+        for (; x + 4 <= n; x += 4)
+        {
+            __m128i vSrc = _mm_loadu_si128((const __m128i*)(src + x));
+            __m128i vDst = _mm_loadu_si128((const __m128i*)(dst + x));
+            __m128i vHidden = _mm_cmpeq_epi32(_mm_and_si128(vSrc, vKeyMask), vKey);
+            __m128i vOut = _mm_or_si128(_mm_and_si128(vSrc, vKeep), vSet);
+            //Pas de blendv en SSE2 : (hidden & dst) | (~hidden & out)
+            vOut = _mm_or_si128(_mm_and_si128(vHidden, vDst), _mm_andnot_si128(vHidden, vOut));
+            _mm_storeu_si128((__m128i*)(dst + x), vOut);
+        }
+        blitKeyScalar(src + x, dst + x, n - x, k);
+    }
+
+    WOLFSHEEP_TARGET("avx2")
+    void blitKeyAVX2(const Uint32* src, Uint32* dst, int n, const keyLine& k)
+    {
+        const __m256i vKey = _mm256_set1_epi32((int)k.key);
+        const __m256i vKeyMask = _mm256_set1_epi32((int)k.keyMask);
+        const __m256i vKeep = _mm256_set1_epi32((int)k.keepMask);
+        const __m256i vSet = _mm256_set1_epi32((int)k.setBits);
+        int x = 0;
+        for (; x + 8 <= n; x += 8)
+        {
+            __m256i vSrc = _mm256_loadu_si256((const __m256i*)(src + x));
+            __m256i vDst = _mm256_loadu_si256((const __m256i*)(dst + x));
+            __m256i vHidden = _mm256_cmpeq_epi32(_mm256_and_si256(vSrc, vKeyMask), vKey);
+            __m256i vOut = _mm256_or_si256(_mm256_and_si256(vSrc, vKeep), vSet);
+            _mm256_storeu_si256((__m256i*)(dst + x), _mm256_blendv_epi8(vOut, vDst, vHidden));
+        }
+        blitKeySSE2(src + x, dst + x, n - x, k);
+    }
+
+    bool cpuHasAvx2()
+    {
+#ifdef _MSC_VER
+        int vRegs[4];
+        __cpuid(vRegs, 0);
+        if (vRegs[0] < 7)
+            return false;
+        __cpuid(vRegs, 1);
+        bool vOsSaves = (vRegs[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6;//OSXSAVE, registres ymm
+        __cpuidex(vRegs, 7, 0);
+        return vOsSaves && (vRegs[1] & (1 << 5));
+#else
+        __builtin_cpu_init();//Appele pendant l'initialisation des statiques
+        return __builtin_cpu_supports("avx2");
+#endif
+    }
+#endif
+} // namespace
+
+blitKernel spriteBatch::kernel_ = spriteBatch::getBestKernel();
+bool spriteBatch::check_ = false;
+unsigned long spriteBatch::checkedFrames_ = 0;
+/////////////////////////////////////////////
+void spriteBatch::clear() { this->sprites_.clear(); }
+const std::vector<spriteDraw>& spriteBatch::getSprites() { return this->sprites_; }
+/////////////////////////////////////////////
+void spriteBatch::setOrigin(int x, int y)
+{
+    this->xOrigin_ = x;
+    this->yOrigin_ = y;
+}
+/////////////////////////////////////////////
+void spriteBatch::addSprite(SDL_Surface* image, int x, int y)
+{
+    x -= this->xOrigin_;
+    y -= this->yOrigin_;
+    this->sprites_.push_back({ image, { x, y, image->w, image->h }, 0, y + image->h });
+}
+/////////////////////////////////////////////
+void spriteBatch::addFill(const SDL_Rect& rect, Uint32 color, int depth)
+{
+    SDL_Rect vRect = { rect.x - this->xOrigin_, rect.y - this->yOrigin_, rect.w, rect.h };
+    this->sprites_.push_back({ NULL, vRect, color, depth - this->yOrigin_ });
+}
+/////////////////////////////////////////////
+bool spriteBatch::isSupported(blitKernel kernel)
+{
+    switch (kernel)
+    {
+        case blitKernel::sdl:
+        case blitKernel::scalar:
+            return true;
+#ifdef WOLFSHEEP_X86
+        case blitKernel::sse2:
+            return true;//Toujours present en x86-64, suppose en x86
+        case blitKernel::avx2:
+            return cpuHasAvx2();
+#endif
+        default:
+            return false;
+    }
+}
+/////////////////////////////////////////////
+blitKernel spriteBatch::getBestKernel()
+{
+    for (blitKernel vKernel : { blitKernel::avx2, blitKernel::sse2 })
+        if (isSupported(vKernel))
+            return vKernel;
+    return blitKernel::scalar;
+}
+/////////////////////////////////////////////
+void spriteBatch::setKernel(blitKernel kernel)
+{
+    if (!isSupported(kernel))
+        throw std::runtime_error("Blit kernel not supported by this processor\n");
+    kernel_ = kernel;
+}
+void spriteBatch::setCheck(bool check) { check_ = check; }
+unsigned long spriteBatch::getCheckedFrames() { return checkedFrames_; }
+/////////////////////////////////////////////
+blitKernel spriteBatch::parseKernel(const std::string& name)
+{
+    if (name == "sdl") return blitKernel::sdl;
+    if (name == "scalar") return blitKernel::scalar;
+    if (name == "sse2") return blitKernel::sse2;
+    if (name == "avx2") return blitKernel::avx2;
+    throw std::runtime_error("Unknown blit kernel " + name + " (sdl, scalar, sse2, avx2)\n");
+}
+/////////////////////////////////////////////
+bool spriteBatch::isKernelPath(const spriteDraw& pSprite, SDL_Surface* target, blitKernel kernel)
+{
+    if (pSprite.image_ == NULL)
+        return true;//SDL_FillRect n'ecrit que dans son rectangle
+    SDL_Surface* vImage = pSprite.image_;
+    SDL_BlendMode vBlend = SDL_BLENDMODE_NONE;
+    SDL_GetSurfaceBlendMode(vImage, &vBlend);
+    //Noyaux : meme format 32 bits, ni fusion alpha ni modulation
+    return kernel != blitKernel::sdl && vBlend == SDL_BLENDMODE_NONE
+        && vImage->format->format == target->format->format && vImage->format->BytesPerPixel == 4
+        && !SDL_MUSTLOCK(vImage) && !SDL_MUSTLOCK(target);
+}
+/////////////////////////////////////////////
+void spriteBatch::drawSprite(const spriteDraw& pSprite, SDL_Surface* target, const SDL_Rect& clip, blitKernel kernel)
+{
+    SDL_Rect vVisible;
+    if (!SDL_IntersectRect(&pSprite.rect_, &clip, &vVisible))
+        return;
+    if (pSprite.image_ == NULL)
+    {
+        SDL_FillRect(target, &vVisible, pSprite.color_);
+        return;
+    }
+    SDL_Surface* vImage = pSprite.image_;
+    Uint32 vKey = 0;
+    bool vHasKey = SDL_GetColorKey(vImage, &vKey) == 0;
+    if (!isKernelPath(pSprite, target, kernel))
+    {
+        SDL_Rect vSource = { vVisible.x - pSprite.rect_.x, vVisible.y - pSprite.rect_.y, vVisible.w, vVisible.h };
+        SDL_Rect vDestination = vVisible;//Deja dans clip
+        SDL_BlitSurface(vImage, &vSource, target, &vDestination);
+        return;
+    }
+    const SDL_PixelFormat* vFormat = target->format;
+    keyLine vLine;
+    vLine.keyMask = ~vImage->format->Amask;
+    vLine.key = vKey & vLine.keyMask;
+    if (vFormat->Amask)//Cible avec alpha : pixel rendu opaque
+    {
+        vLine.keepMask = 0xFFFFFFFF;
+        vLine.setBits = vFormat->Amask;
+    }
+    else
+    {
+        vLine.keepMask = vFormat->Rmask | vFormat->Gmask | vFormat->Bmask;
+        vLine.setBits = 0;
+    }
+    for (int y = 0; y < vVisible.h; y++)
+    {
+        const Uint32* vSrc = (const Uint32*)((const Uint8*)vImage->pixels + (vVisible.y - pSprite.rect_.y + y) * vImage->pitch) + (vVisible.x - pSprite.rect_.x);
+        Uint32* vDst = (Uint32*)((Uint8*)target->pixels + (vVisible.y + y) * target->pitch) + vVisible.x;
+        if (!vHasKey)
+        {
+            memcpy(vDst, vSrc, vVisible.w * 4);//Comme SDL_BlitCopy
+            continue;
+        }
+        switch (kernel)
+        {
+#ifdef WOLFSHEEP_X86
+            case blitKernel::avx2: blitKeyAVX2(vSrc, vDst, vVisible.w, vLine); break;
+            case blitKernel::sse2: blitKeySSE2(vSrc, vDst, vVisible.w, vLine); break;
+#endif
+            default: blitKeyScalar(vSrc, vDst, vVisible.w, vLine); break;
+        }
+    }
+}
+/////////////////////////////////////////////
+void spriteBatch::drawAll(SDL_Surface* target, const SDL_Rect& clip, blitKernel kernel)
+{
+    for (const spriteDraw& vSprite : this->sprites_)
+        drawSprite(vSprite, target, clip, kernel);
+}
+/////////////////////////////////////////////
+void spriteBatch::drawTiles(SDL_Surface* target, const SDL_Rect& clip, blitKernel kernel, threadPool& pool)
+{
+    //SDL_BlitSurface garde un etat dans la surface source : pas de parallele avec lui
+    bool vParallel = (int)this->sprites_.size() >= render_parallel_min && pool.getThreadCount() > 1;
+    for (int s = 0; vParallel && s < (int)this->sprites_.size(); s++)
+        vParallel = isKernelPath(this->sprites_[s], target, kernel);
+    if (!vParallel)
+    {
+        this->drawAll(target, clip, kernel);
+        return;
+    }
+    //Chaque sprite va dans la liste de toutes les tuiles que sa boite touche
+    int vColumns = (clip.w + render_tile_size - 1) / render_tile_size;
+    int vRows = (clip.h + render_tile_size - 1) / render_tile_size;
+    this->tiles_.resize(vColumns * vRows);
+    for (std::vector<int>& vTile : this->tiles_)
+        vTile.clear();
+    for (int s = 0; s < (int)this->sprites_.size(); s++)
+    {
+        SDL_Rect vVisible;
+        if (!SDL_IntersectRect(&this->sprites_[s].rect_, &clip, &vVisible))
+            continue;
+        int vColumnMax = (vVisible.x + vVisible.w - 1 - clip.x) / render_tile_size;
+        int vRowMax = (vVisible.y + vVisible.h - 1 - clip.y) / render_tile_size;
+        for (int r = (vVisible.y - clip.y) / render_tile_size; r <= vRowMax; r++)
+            for (int c = (vVisible.x - clip.x) / render_tile_size; c <= vColumnMax; c++)
+                this->tiles_[r * vColumns + c].push_back(s);
+    }
+    pool.parallelFor(vColumns * vRows, [&](int begin, int end) {
+        for (int t = begin; t < end; t++)
+        {
+            SDL_Rect vTile = { clip.x + (t % vColumns) * render_tile_size, clip.y + (t / vColumns) * render_tile_size, render_tile_size, render_tile_size };
+            SDL_Rect vTileClip;
+            if (!SDL_IntersectRect(&vTile, &clip, &vTileClip))
+                continue;
+            for (int s : this->tiles_[t])
+                drawSprite(this->sprites_[s], target, vTileClip, kernel);
+        }
+    }, 1);//Une tuile par morceau : peu de tuiles, chacune couteuse
+}
+/////////////////////////////////////////////
+void spriteBatch::checkKernels(SDL_Surface* target, const SDL_Rect& clip, threadPool& pool)
+{
+    //Reference : SDL_BlitSurface sur une copie de la cible, puis chaque noyau sur une autre copie
+    SDL_Surface* vReference = SDL_CreateRGBSurfaceWithFormat(0, target->w, target->h, 32, target->format->format);
+    SDL_Surface* vCandidate = SDL_CreateRGBSurfaceWithFormat(0, target->w, target->h, 32, target->format->format);
+    if (vReference == NULL || vCandidate == NULL)
+        throw std::runtime_error(std::string(SDL_GetError()));
+    int vLine = target->w * 4;
+    for (int y = 0; y < target->h; y++)
+        memcpy((Uint8*)vReference->pixels + y * vReference->pitch, (Uint8*)target->pixels + y * target->pitch, vLine);
+    this->drawAll(vReference, clip, blitKernel::sdl);
+    //Chaque noyau en serie, puis le noyau choisi par tuiles en parallele
+    std::vector<std::pair<blitKernel, bool>> vCandidates = { { blitKernel::scalar, false }, { blitKernel::sse2, false }, { blitKernel::avx2, false }, { kernel_, true } };
+    for (const std::pair<blitKernel, bool>& vRun : vCandidates)
+    {
+        blitKernel vKernel = vRun.first;
+        if (!isSupported(vKernel))
+            continue;
+        for (int y = 0; y < target->h; y++)
+            memcpy((Uint8*)vCandidate->pixels + y * vCandidate->pitch, (Uint8*)target->pixels + y * target->pitch, vLine);
+        if (vRun.second)
+            this->drawTiles(vCandidate, clip, vKernel, pool);
+        else
+            this->drawAll(vCandidate, clip, vKernel);
+        for (int y = 0; y < target->h; y++)
+            if (memcmp((Uint8*)vReference->pixels + y * vReference->pitch, (Uint8*)vCandidate->pixels + y * vCandidate->pitch, vLine) != 0)
+                throw std::runtime_error("Blit check : kernel " + std::to_string((int)vKernel) + (vRun.second ? " (tiles)" : "") + " differs from SDL_BlitSurface on line " + std::to_string(y) + "\n");
+    }
+    SDL_FreeSurface(vCandidate);
+    SDL_FreeSurface(vReference);
+    checkedFrames_++;
+}
+/////////////////////////////////////////////
+void spriteBatch::draw(SDL_Surface* target, threadPool& pool)
+{
+    //Les plus bas par dessus, l'ordre d'ajout departage (cadre du chien sous le chien)
+    std::stable_sort(this->sprites_.begin(), this->sprites_.end(), [](const spriteDraw& a, const spriteDraw& b) { return a.depth_ < b.depth_; });
+    SDL_Rect vClip = target->clip_rect;
+    if (check_ && target->format->BytesPerPixel == 4)
+        this->checkKernels(target, vClip, pool);
+    this->drawTiles(target, vClip, kernel_, pool);
+}
+//*****************************************************************************
+// ***************************** DISTANCE KERNEL ******************************
+//*****************************************************************************
+namespace
+{
+    // Reference : meme calcul que speciesTable::getDistance, sans std::sqrt
+    void squaredDistancesScalar(int x, int y, const int* xs, const int* ys, int n, int width, int height, int* out)
+    {
+        for (int k = 0; k < n; k++)
+        {
+            int xDistance = std::min(abs(x - xs[k]), abs(x - xs[k] - width));
+            int yDistance = std::min(abs(y - ys[k]), abs(y - ys[k] - height));
+            out[k] = xDistance * xDistance + yDistance * yDistance;
+        }
+    }
+#ifdef WOLFSHEEP_X86
+    // SSE2 n'a ni abs, ni min, ni multiplication 32 bits : on les compose
+    WOLFSHEEP_TARGET("sse2")
+    __m128i absSSE2(__m128i v)
+    {
+        __m128i vSign = _mm_srai_epi32(v, 31);
+        return _mm_sub_epi32(_mm_xor_si128(v, vSign), vSign);
+    }
+
+    WOLFSHEEP_TARGET("sse2")
+    __m128i minSSE2(__m128i a, __m128i b)
+    {
+        __m128i vGreater = _mm_cmpgt_epi32(a, b);
+        return _mm_or_si128(_mm_and_si128(vGreater, b), _mm_andnot_si128(vGreater, a));
+    }
+
+    WOLFSHEEP_TARGET("sse2")
+    __m128i squareSSE2(__m128i v)
+    {
+        //Voies paires et impaires par _mm_mul_epu32 (v >= 0), puis reentrelacees
+        __m128i vEven = _mm_mul_epu32(v, v);
+        __m128i vOdd = _mm_mul_epu32(_mm_srli_epi64(v, 32), _mm_srli_epi64(v, 32));
+        return _mm_unpacklo_epi32(_mm_shuffle_epi32(vEven, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(vOdd, _MM_SHUFFLE(0, 0, 2, 0)));
+    }
+
+    WOLFSHEEP_TARGET("sse2")
+    void squaredDistancesSSE2(int x, int y, const int* xs, const int* ys, int n, int width, int height, int* out)
+    {
+        const __m128i vX = _mm_set1_epi32(x);
+        const __m128i vY = _mm_set1_epi32(y);
+        const __m128i vWidth = _mm_set1_epi32(width);
+        const __m128i vHeight = _mm_set1_epi32(height);
+        int k = 0;
+        for (; k + 4 <= n; k += 4)
+        {
+            __m128i vDx = _mm_sub_epi32(vX, _mm_loadu_si128((const __m128i*)(xs + k)));
+            __m128i vDy = _mm_sub_epi32(vY, _mm_loadu_si128((const __m128i*)(ys + k)));
+            vDx = minSSE2(absSSE2(vDx), absSSE2(_mm_sub_epi32(vDx, vWidth)));
+            vDy = minSSE2(absSSE2(vDy), absSSE2(_mm_sub_epi32(vDy, vHeight)));
+            _mm_storeu_si128((__m128i*)(out + k), _mm_add_epi32(squareSSE2(vDx), squareSSE2(vDy)));
+        }
+        squaredDistancesScalar(x, y, xs + k, ys + k, n - k, width, height, out + k);
+    }
+
+    WOLFSHEEP_TARGET("avx2")
+    void squaredDistancesAVX2(int x, int y, const int* xs, const int* ys, int n, int width, int height, int* out)
+    {
+        const __m256i vX = _mm256_set1_epi32(x);
+        const __m256i vY = _mm256_set1_epi32(y);
+        const __m256i vWidth = _mm256_set1_epi32(width);
+        const __m256i vHeight = _mm256_set1_epi32(height);
+        int k = 0;
+        for (; k + 8 <= n; k += 8)
+        {
+            __m256i vDx = _mm256_sub_epi32(vX, _mm256_loadu_si256((const __m256i*)(xs + k)));
+            __m256i vDy = _mm256_sub_epi32(vY, _mm256_loadu_si256((const __m256i*)(ys + k)));
+            vDx = _mm256_min_epi32(_mm256_abs_epi32(vDx), _mm256_abs_epi32(_mm256_sub_epi32(vDx, vWidth)));
+            vDy = _mm256_min_epi32(_mm256_abs_epi32(vDy), _mm256_abs_epi32(_mm256_sub_epi32(vDy, vHeight)));
+            __m256i vSum = _mm256_add_epi32(_mm256_mullo_epi32(vDx, vDx), _mm256_mullo_epi32(vDy, vDy));
+            _mm256_storeu_si256((__m256i*)(out + k), vSum);
+        }
+        squaredDistancesSSE2(x, y, xs + k, ys + k, n - k, width, height, out + k);
+    }
+#endif
+} // namespace
+
+blitKernel distanceKernel::kernel_ = spriteBatch::getBestKernel();
+bool distanceKernel::check_ = false;
+std::atomic<unsigned long> distanceKernel::checkedBlocks_{ 0 };
+/////////////////////////////////////////////
+void distanceKernel::squaredDistances(int x, int y, const int* xs, const int* ys, int n, int width, int height, int* out, blitKernel kernel)
+{
+    switch (kernel)
+    {
+#ifdef WOLFSHEEP_X86
+        case blitKernel::avx2: squaredDistancesAVX2(x, y, xs, ys, n, width, height, out); break;
+        case blitKernel::sse2: squaredDistancesSSE2(x, y, xs, ys, n, width, height, out); break;
+#endif
+        default: squaredDistancesScalar(x, y, xs, ys, n, width, height, out); break;
+    }
+}
+/////////////////////////////////////////////
+void distanceKernel::squaredDistances(int x, int y, const int* xs, const int* ys, int n, int width, int height, int* out)
+{
+    squaredDistances(x, y, xs, ys, n, width, height, out, kernel_);
+    if (!check_ || n == 0)
+        return;
+    thread_local std::vector<int> vReference;
+    vReference.resize(n);
+    squaredDistancesScalar(x, y, xs, ys, n, width, height, vReference.data());
+    if (memcmp(vReference.data(), out, n * sizeof(int)) != 0)
+        throw std::runtime_error("Distance check : kernel " + std::to_string((int)kernel_) + " differs from the scalar reference\n");
+    checkedBlocks_.fetch_add(1, std::memory_order_relaxed);
+}
+/////////////////////////////////////////////
+void distanceKernel::setKernel(blitKernel kernel)
+{
+    if (!spriteBatch::isSupported(kernel))
+        throw std::runtime_error("Distance kernel not supported by this processor\n");
+    kernel_ = kernel;
+}
+void distanceKernel::setCheck(bool check) { check_ = check; }
+unsigned long distanceKernel::getCheckedBlocks() { return checkedBlocks_.load(); }
+//*****************************************************************************
+// ***************************** RENDERED OBJECT ******************************
+//*****************************************************************************
+renderedObject::renderedObject(const std::string& file_path, SDL_Surface* window_surface_ptr)
+{
+    //Sans surface (headless) on ne charge aucune image
+    this->image_ptr_ = window_surface_ptr != NULL ? spriteAtlas::getSurface(file_path, window_surface_ptr) : NULL;
+    this->window_surface_ptr_ = window_surface_ptr;
+}
+/////////////////////////////////////////////
+bool renderedObject::isRendered() { return this->window_surface_ptr_ != NULL; }
+/////////////////////////////////////////////
+void renderedObject::draw(int x, int y, spriteBatch& batch)
+{
+    if (!this->isRendered())
+        return;
+    //Colle plus tard avec les autres sprites de l'image (ground::drawObjects)
+    batch.addSprite(this->image_ptr_, x, y);
+}
+/////////////////////////////////////////////
+void renderedObject::update(speciesTable& pTable, int i, spriteBatch& batch)
+{
+    this->draw(pTable.x_[i], pTable.y_[i], batch);
+}
+//*****************************************************************************
+// ********************************* SHEPERD **********************************
+//*****************************************************************************
+int shepherd::ImgW = 49;
+int shepherd::ImgH = 49;
+objectPool<shepherd> shepherd::pool_;
+void* shepherd::operator new(size_t size)
+{
+    assert(size == sizeof(shepherd));
+    return pool_.allocate();
+}
+void shepherd::operator delete(void* place) { pool_.deallocate(place); }
+shepherd::shepherd(SDL_Surface* window_surface_ptr) :
+    renderedObject("media/shepherd.png", window_surface_ptr)
+{}
+//*****************************************************************************
+//************************************ DOG ************************************
+//*****************************************************************************
+int dog::ImgW = 49;
+int dog::ImgH = 49;
+objectPool<dog> dog::pool_;
+void* dog::operator new(size_t size)
+{
+    assert(size == sizeof(dog));
+    return pool_.allocate();
+}
+void dog::operator delete(void* place) { pool_.deallocate(place); }
+dog::dog(SDL_Surface* window_surface_ptr) :
+    renderedObject("media/dog.png", window_surface_ptr)
+{}
+/////////////////////////////////////////////
+void dog::update(speciesTable& pTable, int i, spriteBatch& batch)
+{
+    if (!this->isRendered())
+        return;
+    //Cadre de selection
+    SDL_Rect vRect = { pTable.x_[i] - 2, pTable.y_[i] - 2, pTable.width_ + 4, pTable.height_ + 4 };
+    if (pTable.hasPropertie(i, propertie::clicked))
+        batch.addFill(vRect, 0xFF0000, pTable.y_[i] + pTable.height_);
+    if (pTable.hasPropertie(i, propertie::go))
+        batch.addFill(vRect, 0x0080FF, pTable.y_[i] + pTable.height_);
+    this->draw(pTable.x_[i], pTable.y_[i], batch);
+}
+//*****************************************************************************
+//*********************************** SHEEP ***********************************
+//*****************************************************************************
+int sheep::ImgW = 68;
+int sheep::ImgH = 60;
+int sheep::FrameInterval = 10;
+/////////////////////////////////////////////
+std::vector<std::vector<std::string>> sheep::getPaths()
+{
+    std::string p = "media/sheeps/";
+    std::vector<std::vector<std::string>> vPaths(static_cast<size_t>(direction::count));
+    for (int i = 1; i <= 10; i++)
+    {
+        vPaths[static_cast<size_t>(direction::nw)].push_back(p + "nw (" + std::to_string(i) + ").png");
+        vPaths[static_cast<size_t>(direction::ne)].push_back(p + "ne (" + std::to_string(i) + ").png");
+        vPaths[static_cast<size_t>(direction::sw)].push_back(p + "sw (" + std::to_string(i) + ").png");
+        vPaths[static_cast<size_t>(direction::se)].push_back(p + "se (" + std::to_string(i) + ").png");
+    }
+    return vPaths;
+}
+//*****************************************************************************
+//*********************************** WOLF ************************************
+//*****************************************************************************
+int wolf::ImgW = 157;
+int wolf::ImgH = 110;
+int wolf::FrameInterval = 5;
+/////////////////////////////////////////////
+std::vector<std::vector<std::string>> wolf::getPaths()
+{
+    std::string p = "media/wolfs/";
+    std::vector<std::vector<std::string>> vPaths(static_cast<size_t>(direction::count));
+    for (int i = 1; i <= 12; i++)
+    {
+        vPaths[static_cast<size_t>(direction::nw)].push_back(p + "nw (" + std::to_string(i) + ").png");
+        vPaths[static_cast<size_t>(direction::ne)].push_back(p + "ne (" + std::to_string(i) + ").png");
+        vPaths[static_cast<size_t>(direction::sw)].push_back(p + "sw (" + std::to_string(i) + ").png");
+        vPaths[static_cast<size_t>(direction::se)].push_back(p + "se (" + std::to_string(i) + ").png");
+    }
+    return vPaths;
+}
+//*****************************************************************************
+// ******************************* SPATIAL GRID *******************************
+//*****************************************************************************
+spatialGrid::spatialGrid(int cellSize, int width, int height)
+{
+    this->cellSize_ = cellSize;
+    this->columns_ = width / cellSize + 1;
+    this->rows_ = height / cellSize + 1;
+    this->cells_.resize(this->columns_ * this->rows_);
+}
+/////////////////////////////////////////////
+int spatialGrid::getColumn(int x) { return std::max(0, std::min(this->columns_ - 1, x / this->cellSize_)); }
+int spatialGrid::getRow(int y) { return std::max(0, std::min(this->rows_ - 1, y / this->cellSize_)); }
+int spatialGrid::getCellSize() { return this->cellSize_; }
+int spatialGrid::getMaxRing() { return std::max(this->columns_, this->rows_); }
+/////////////////////////////////////////////
+void spatialGrid::clear()
+{
+    //Garde la capacite des cases : pas d'allocation d'un tick a l'autre
+    for (std::vector<int>& vCell : this->cells_)
+        vCell.clear();
+}
+/////////////////////////////////////////////
+void spatialGrid::insert(int index, int x, int y)
+{
+    this->cells_[this->getRow(y) * this->columns_ + this->getColumn(x)].push_back(index);
+}
+/////////////////////////////////////////////
+void spatialGrid::query(int xMin, int yMin, int xMax, int yMax, std::vector<int>& out)
+{
+    for (int r = this->getRow(yMin); r <= this->getRow(yMax); r++)
+        for (int c = this->getColumn(xMin); c <= this->getColumn(xMax); c++)
+        {
+            std::vector<int>& vCell = this->cells_[r * this->columns_ + c];
+            out.insert(out.end(), vCell.begin(), vCell.end());
+        }
+}
+/////////////////////////////////////////////
+void spatialGrid::queryRing(int x, int y, int ring, std::vector<int>& out)
+{
+    int vC = this->getColumn(x);
+    int vR = this->getRow(y);
+    for (int r = vR - ring; r <= vR + ring; r++)
+    {
+        if (r < 0 || r >= this->rows_)
+            continue;
+        //Seules les cases du bord de l'anneau
+        int vStep = (r == vR - ring || r == vR + ring) ? 1 : std::max(1, 2 * ring);
+        for (int c = vC - ring; c <= vC + ring; c += vStep)
+        {
+            if (c < 0 || c >= this->columns_)
+                continue;
+            std::vector<int>& vCell = this->cells_[r * this->columns_ + c];
+            out.insert(out.end(), vCell.begin(), vCell.end());
+        }
+    }
+}
+//*****************************************************************************
+// ****************************** LEVEL OF DETAIL *****************************
+//*****************************************************************************
+chunkMap::chunkMap(int width, int height)
+{
+    this->columns_ = (width + lod_chunk_size - 1) / lod_chunk_size;
+    this->rows_ = (height + lod_chunk_size - 1) / lod_chunk_size;
+    this->near_.resize(this->size());
+    //Tout est actif au depart : les regions lointaines s'endorment apres lod_demote_ticks
+    this->active_.assign(this->size(), 1);
+    this->quiet_.assign(this->size(), 0);
+}
+/////////////////////////////////////////////
+int chunkMap::size() { return this->columns_ * this->rows_; }
+/////////////////////////////////////////////
+int chunkMap::getChunk(int x, int y)
+{
+    int vColumn = std::max(0, std::min(this->columns_ - 1, x / lod_chunk_size));
+    int vRow = std::max(0, std::min(this->rows_ - 1, y / lod_chunk_size));
+    return vRow * this->columns_ + vColumn;
+}
+/////////////////////////////////////////////
+void chunkMap::mark(int x, int y, int radius)
+{
+    //Rayon radius : a reveiller, une region de plus : a garder active
+    int vChunk = this->getChunk(x, y);
+    int vColumn = vChunk % this->columns_;
+    int vRow = vChunk / this->columns_;
+    for (int r = std::max(0, vRow - radius - 1); r <= std::min(this->rows_ - 1, vRow + radius + 1); r++)
+        for (int c = std::max(0, vColumn - radius - 1); c <= std::min(this->columns_ - 1, vColumn + radius + 1); c++)
+        {
+            uint8_t vNear = (abs(r - vRow) <= radius && abs(c - vColumn) <= radius) ? 2 : 1;
+            uint8_t& vCell = this->near_[r * this->columns_ + c];
+            vCell = std::max(vCell, vNear);
+        }
+}
+/////////////////////////////////////////////
+void chunkMap::update(speciesTable& pShepherds, speciesTable& pWolves)
+{
+    std::fill(this->near_.begin(), this->near_.end(), 0);
+    for (int i = 0; i < pShepherds.size(); i++)
+        this->mark(pShepherds.getXBox(i), pShepherds.getYBox(i), lod_shepherd_radius);
+    for (int i = 0; i < pWolves.size(); i++)
+        this->mark(pWolves.getXBox(i), pWolves.getYBox(i), lod_wolf_radius);
+    for (int c = 0; c < this->size(); c++)
+    {
+        if (this->near_[c] == 2)
+            this->active_[c] = 1;
+        if (!this->active_[c])
+            continue;
+        if (this->near_[c] != 0)
+            this->quiet_[c] = 0;
+        else if (++this->quiet_[c] >= (uint32_t)lod_demote_ticks)
+            this->active_[c] = 0;
+    }
+}
+/////////////////////////////////////////////
+int chunkMap::getStep(int chunk, uint64_t tick, int period)
+{
+    if (this->active_[chunk] || period <= 1)
+        return 1;
+    //Les regions endormies sont decalees d'un tick : la charge est repartie
+    return (tick + chunk) % period == 0 ? period : 0;
+}
+//*****************************************************************************
+// ******************************** TIMER WHEEL *******************************
+//*****************************************************************************
+timerWheel::timerWheel()
+{
+    this->slots_.resize(timer_wheel_levels << timer_wheel_bits);
+    this->now_ = 0;
+}
+/////////////////////////////////////////////
+void timerWheel::reset(uint64_t now)
+{
+    for (std::vector<timerEvent>& vSlot : this->slots_)
+        vSlot.clear();
+    this->now_ = now;
+}
+/////////////////////////////////////////////
+void timerWheel::insert(const timerEvent& pEvent)
+{
+    //Niveau l : l'echeance tombe dans moins de 2^(bits * (l + 1)) ticks. La case
+    //est prise dans les bits absolus du tick, elle est atteinte avant l'echeance
+    uint64_t vDelta = pEvent.tick_ - this->now_;
+    int vLevel = 0;
+    while (vLevel < timer_wheel_levels - 1 && (vDelta >> (timer_wheel_bits * (vLevel + 1))) != 0)
+        vLevel++;
+    int vSlot = (int)((pEvent.tick_ >> (timer_wheel_bits * vLevel)) & ((1 << timer_wheel_bits) - 1));
+    this->slots_[(vLevel << timer_wheel_bits) + vSlot].push_back(pEvent);
+}
+/////////////////////////////////////////////
+void timerWheel::schedule(uint64_t tick, uint32_t id, timerKind kind)
+{
+    this->insert({ std::max(tick, this->now_ + 1), id, kind });
+}
+/////////////////////////////////////////////
+void timerWheel::advance(uint64_t tick, std::vector<timerEvent>& out)
+{
+    out.clear();
+    std::vector<timerEvent> vCascade;
+    while (this->now_ < tick)
+    {
+        uint64_t vTick = ++this->now_;
+        //Debut d'une case d'un niveau superieur : ses echeances redescendent, a
+        //moins de 2^(bits * level) ticks de now_
+        for (int vLevel = timer_wheel_levels - 1; vLevel > 0; vLevel--)
+        {
+            if ((vTick & ((1ull << (timer_wheel_bits * vLevel)) - 1)) != 0)
+                continue;
+            int vSlot = (int)((vTick >> (timer_wheel_bits * vLevel)) & ((1 << timer_wheel_bits) - 1));
+            vCascade.swap(this->slots_[(vLevel << timer_wheel_bits) + vSlot]);
+            for (const timerEvent& vEvent : vCascade)
+                this->insert(vEvent);
+            vCascade.clear();
+        }
+        std::vector<timerEvent>& vDue = this->slots_[vTick & ((1 << timer_wheel_bits) - 1)];
+        out.insert(out.end(), vDue.begin(), vDue.end());
+        vDue.clear();
+    }
+    //Cases remplies au fil des ticks et des cascades : ordre stable par id_
+    std::sort(out.begin(), out.end(), [](const timerEvent& a, const timerEvent& b) {
+        return a.id_ != b.id_ ? a.id_ < b.id_ : a.kind_ < b.kind_;
+    });
+}
+/////////////////////////////////////////////
+size_t timerWheel::size()
+{
+    size_t vSize = 0;
+    for (std::vector<timerEvent>& vSlot : this->slots_)
+        vSize += vSlot.size();
+    return vSize;
+}
+//*****************************************************************************
+// ******************************** CHECKPOINT ********************************
+//*****************************************************************************
+namespace
+{
+    uint32_t getColumnCount(speciesTable& pTable)
+    {
+        uint32_t n = 0;
+        forEachColumn(pTable, [&](auto&) { n++; });
+        return n;
+    }
+
+    size_t getColumnBytes(uint32_t count, size_t element = sizeof(uint32_t)) { return ((size_t)count * element + 7) & ~(size_t)7; }
+
+    // Toutes les colonnes d'une table de count entites
+    size_t getTableBytes(speciesTable& pTable, uint32_t count)
+    {
+        size_t n = 0;
+        forEachColumn(pTable, [&](auto& vColumn) { n += getColumnBytes(count, sizeof(vColumn[0])); });
+        return n;
+    }
+
+    // Fichier en lecture seule projete en memoire
+    class mappedFile
+    {
+    private:
+        const char* data_;
+        size_t size_;
+#ifdef _WIN32
+        HANDLE file_;
+        HANDLE mapping_;
+#endif
+
+    public:
+        mappedFile(const std::string& path)
+        {
+            this->data_ = NULL;
+            this->size_ = 0;
+#ifdef _WIN32
+            this->mapping_ = NULL;
+            this->file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+            if (this->file_ == INVALID_HANDLE_VALUE)
+                throw std::runtime_error("Unable to open checkpoint " + path + "\n");
+            LARGE_INTEGER vSize;
+            GetFileSizeEx(this->file_, &vSize);
+            this->size_ = (size_t)vSize.QuadPart;
+            this->mapping_ = CreateFileMappingA(this->file_, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (this->mapping_ != NULL)
+                this->data_ = (const char*)MapViewOfFile(this->mapping_, FILE_MAP_READ, 0, 0, 0);
+#else
+            int vFile = open(path.c_str(), O_RDONLY);
+            if (vFile < 0)
+                throw std::runtime_error("Unable to open checkpoint " + path + "\n");
+            struct stat vStat;
+            fstat(vFile, &vStat);
+            this->size_ = (size_t)vStat.st_size;
+            void* vData = this->size_ > 0 ? mmap(NULL, this->size_, PROT_READ, MAP_PRIVATE, vFile, 0) : MAP_FAILED;
+            close(vFile);//La projection reste valide
+            this->data_ = vData != MAP_FAILED ? (const char*)vData : NULL;
+#endif
+            if (this->data_ == NULL)
+            {
+                this->release();
+                throw std::runtime_error("Unable to map checkpoint " + path + "\n");
+            }
+        }
+        ~mappedFile() { this->release(); }
+
+        void release()
+        {
+#ifdef _WIN32
+            if (this->data_ != NULL)
+                UnmapViewOfFile(this->data_);
+            if (this->mapping_ != NULL)
+                CloseHandle(this->mapping_);
+            if (this->file_ != INVALID_HANDLE_VALUE)
+                CloseHandle(this->file_);
+            this->mapping_ = NULL;
+            this->file_ = INVALID_HANDLE_VALUE;
+#else
+            if (this->data_ != NULL)
+                munmap((void*)this->data_, this->size_);
+#endif
+            this->data_ = NULL;
+        }
+        const char* getData() { return this->data_; }
+        size_t getSize() { return this->size_; }
+    };
+} // namespace
+
+checkpointWriter::checkpointWriter()
+{
+    this->writing_ = false;
+    this->stop_ = false;
+}
+/////////////////////////////////////////////
+checkpointWriter::~checkpointWriter()
+{
+    {
+        std::lock_guard<std::mutex> vLock(this->mutex_);
+        this->stop_ = true;
+    }
+    this->wake_.notify_all();
+    if (this->thread_.joinable())
+        this->thread_.join();
+}
+/////////////////////////////////////////////
+bool checkpointWriter::push(const std::string& path, std::vector<char>&& data)
+{
+    {
+        std::lock_guard<std::mutex> vLock(this->mutex_);
+        if ((int)this->queue_.size() + this->writing_ >= checkpoint_max_pending)
+            return false;
+        if (!this->thread_.joinable())
+            this->thread_ = std::thread(&checkpointWriter::work, this);
+        this->queue_.emplace_back(path, std::move(data));
+    }
+    this->wake_.notify_one();
+    return true;
+}
+/////////////////////////////////////////////
+void checkpointWriter::wait()
+{
+    std::unique_lock<std::mutex> vLock(this->mutex_);
+    this->idle_.wait(vLock, [this] { return this->queue_.empty() && !this->writing_; });
+}
+/////////////////////////////////////////////
+void checkpointWriter::work()
+{
+    std::unique_lock<std::mutex> vLock(this->mutex_);
+    while (true)
+    {
+        this->wake_.wait(vLock, [this] { return this->stop_ || !this->queue_.empty(); });
+        //A l'arret on finit d'abord la file
+        if (this->queue_.empty())
+            return;
+        std::pair<std::string, std::vector<char>> vJob = std::move(this->queue_.front());
+        this->queue_.pop_front();
+        this->writing_ = true;
+        vLock.unlock();
+        //Ecrit a cote puis renomme : jamais de fichier a moitie ecrit
+        std::string vTemporary = vJob.first + ".tmp";
+        FILE* vFile = fopen(vTemporary.c_str(), "wb");
+        bool vDone = vFile != NULL && fwrite(vJob.second.data(), 1, vJob.second.size(), vFile) == vJob.second.size();
+        if (vFile != NULL)
+            vDone = fclose(vFile) == 0 && vDone;
+        std::remove(vJob.first.c_str());
+        if (!vDone || std::rename(vTemporary.c_str(), vJob.first.c_str()) != 0)
+            fprintf(stderr, "Unable to write checkpoint %s\n", vJob.first.c_str());
+        vLock.lock();
+        this->writing_ = false;
+        this->idle_.notify_all();
+    }
+}
 //*****************************************************************************
-// ********************************* OBJECT ***********************************
+// ********************************* TELEMETRY ********************************
 //*****************************************************************************
-object::object()
+telemetryWriter::telemetryWriter(const std::string& path)
+{
+    this->stop_ = false;
+    this->dropped_ = 0;
+    this->binary_ = path.size() >= 4 && path.compare(path.size() - 4, 4, ".bin") == 0;
+    this->file_ = fopen(path.c_str(), this->binary_ ? "wb" : "w");
+    if (this->file_ == NULL)
+        throw std::runtime_error("Unable to open telemetry file " + path + "\n");
+    if (this->binary_)
+    {
+        const char vMagic[8] = { 'W', 'S', 'T', 'E', 'L', 'E', 'M', 0 };
+        uint32_t vHeader[2] = { telemetry_version, (uint32_t)sizeof(populationStats) };
+        fwrite(vMagic, 1, sizeof(vMagic), this->file_);
+        fwrite(vHeader, 1, sizeof(vHeader), this->file_);
+    }
+    else
+        fprintf(this->file_, "tick,sheep,wolves,births,kills,starvations\n");
+    this->thread_ = std::thread(&telemetryWriter::work, this);
+}
+/////////////////////////////////////////////
+telemetryWriter::~telemetryWriter()
 {
-    this->properties_ = {};
+    this->stop_ = true;
+    this->thread_.join();
+    fclose(this->file_);
 }
 /////////////////////////////////////////////
-void object::addPropertie(std::string pPropertie)
+void telemetryWriter::push(const populationStats& pStats)
 {
-    this->properties_.push_back(pPropertie);
+    if (!this->ring_.push(pStats))
+        this->dropped_++;
 }
+uint64_t telemetryWriter::getDropped() { return this->dropped_; }
 /////////////////////////////////////////////
-bool object::hasPropertie(std::string pPropertie)
+void telemetryWriter::write(const populationStats& pStats)
 {
-    return (std::find(this->properties_.begin(), this->properties_.end(), pPropertie) != this->properties_.end());
+    if (this->binary_)
+        fwrite(&pStats, sizeof(pStats), 1, this->file_);
+    else
+        fprintf(this->file_, "%llu,%u,%u,%llu,%llu,%llu\n", (unsigned long long)pStats.tick_, pStats.sheep_, pStats.wolves_,
+                (unsigned long long)pStats.births_, (unsigned long long)pStats.kills_, (unsigned long long)pStats.starvations_);
 }
 /////////////////////////////////////////////
-bool object::removePropertie(std::string pPropertie)
+void telemetryWriter::work()
 {
-    std::vector<std::string>::iterator itr = std::find(this->properties_.begin(), this->properties_.end(), pPropertie);
-    if (itr != this->properties_.end())
+    //Pas de signal du producteur (il ne doit jamais prendre de verrou) : on scrute la file
+    populationStats vStats;
+    while (true)
     {
-        this->properties_.erase(itr);
-        return true;
+        bool vStop = this->stop_;
+        bool vAny = false;
+        while (this->ring_.pop(vStats))
+        {
+            this->write(vStats);
+            vAny = true;
+        }
+        if (vStop)
+            return;//Rien n'a ete pousse apres stop_
+        if (!vAny)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
     }
-    return false;
 }
 //*****************************************************************************
-// ***************************** RENDERED OBJECT ******************************
+// ********************************* INPUT LOG ********************************
 //*****************************************************************************
-renderedObject::renderedObject(const std::string& file_path, SDL_Surface* window_surface_ptr, int width, int height, int x, int y):
-                object()
+inputLog::inputLog()
 {
-    this->image_ptr_ = load_surface_for(file_path, window_surface_ptr);
-    this->window_surface_ptr_ = window_surface_ptr;
-    this->width_ = width;
-    this->height_ = height;
-    this->x_ = x;
-    this->y_ = y;
+    this->seed_ = 0;
+    this->sheep_ = 0;
+    this->wolves_ = 0;
+    this->worldWidth_ = frame_width;
+    this->worldHeight_ = frame_height;
+    this->lodPeriod_ = 1;
+    this->endTick_ = 0;
+    this->endHash_ = 0;
 }
 /////////////////////////////////////////////
-int renderedObject::getHeightBox() { return this->height_ * 4 / 5 ; }
-int renderedObject::getWidthBox() { return this->width_/ 2 ; }
-int renderedObject::getXBox() { return this->x_ + (this->width_ - this->getWidthBox()) / 2; }
-int renderedObject::getYBox() { return this->y_ + (this->height_ - this->getHeightBox()) / 2;}
-int renderedObject::getX() { return this->x_; }
-int renderedObject::getY() { return this->y_; }
+void inputLog::save(const std::string& path)
+{
+    std::ofstream vFile(path);
+    if (!vFile)
+        throw std::runtime_error("Unable to write input log " + path + "\n");
+    vFile << "wolfsheep-input " << input_log_version << "\nseed " << this->seed_ << "\nsheep " << this->sheep_ << "\nwolves " << this->wolves_
+          << "\nworld " << this->worldWidth_ << " " << this->worldHeight_ << "\nlod " << this->lodPeriod_ << "\n";
+    if (!this->restore_.empty())
+        vFile << "restore " << this->restore_ << "\n";
+    for (const inputEvent& vEvent : this->events_)
+    {
+        vFile << vEvent.type_ << " " << vEvent.tick_ << " " << vEvent.a_;
+        if (vEvent.type_ == 'C')
+            vFile << " " << vEvent.b_;
+        vFile << "\n";
+    }
+    vFile << "end " << this->endTick_ << " " << std::hex << this->endHash_ << std::dec << "\n";
+}
 /////////////////////////////////////////////
-int renderedObject::getDistance(renderedObject* pO2) 
-{ 
-    int xDistance = std::min(abs(this->getXBox() - pO2->getXBox()), abs(this->getXBox() - pO2->getXBox() - pO2->getWidthBox()));
-    int yDistance = std::min(abs(this->getYBox() - pO2->getYBox()), abs(this->getYBox() - pO2->getYBox() - pO2->getHeightBox()));
-    return std::sqrt(xDistance*xDistance + yDistance*yDistance);
+void inputLog::load(const std::string& path)
+{
+    std::ifstream vFile(path);
+    std::string vWord;
+    uint32_t vVersion = 0;
+    if (!(vFile >> vWord >> vVersion) || vWord != "wolfsheep-input")
+        throw std::runtime_error("Not an input log " + path + "\n");
+    if (vVersion != input_log_version)
+        throw std::runtime_error("Input log " + path + " has version " + std::to_string(vVersion) + ", expected " + std::to_string(input_log_version) + "\n");
+    this->events_.clear();
+    this->restore_ = "";
+    this->worldWidth_ = frame_width;
+    this->worldHeight_ = frame_height;
+    this->lodPeriod_ = 1;
+    bool vEnd = false;
+    while (!vEnd && vFile >> vWord)
+    {
+        inputEvent vEvent = { 0, vWord[0], 0, 0 };
+        if (vWord == "seed") vFile >> this->seed_;
+        else if (vWord == "sheep") vFile >> this->sheep_;
+        else if (vWord == "wolves") vFile >> this->wolves_;
+        else if (vWord == "world") vFile >> this->worldWidth_ >> this->worldHeight_;//Absent : la fenetre
+        else if (vWord == "lod") vFile >> this->lodPeriod_;//Absent : tout a chaque tick
+        else if (vWord == "restore") { std::getline(vFile >> std::ws, this->restore_); }
+        else if (vWord == "K") { vFile >> vEvent.tick_ >> vEvent.a_; this->events_.push_back(vEvent); }
+        else if (vWord == "C") { vFile >> vEvent.tick_ >> vEvent.a_ >> vEvent.b_; this->events_.push_back(vEvent); }
+        else if (vWord == "end") { vFile >> this->endTick_ >> std::hex >> this->endHash_ >> std::dec; vEnd = true; }
+        else
+            throw std::runtime_error("Unknown entry " + vWord + " in input log " + path + "\n");
+        if (!vFile)
+            throw std::runtime_error("Corrupted input log " + path + "\n");
+        //application::step rejoue dans l'ordre : une entree plus ancienne que la precedente serait perdue
+        if ((vWord == "K" || vWord == "C") && this->events_.size() > 1 && vEvent.tick_ < this->events_[this->events_.size() - 2].tick_)
+            throw std::runtime_error("Input log " + path + " has an entry at tick " + std::to_string(vEvent.tick_) + " after one at tick "
+                                     + std::to_string(this->events_[this->events_.size() - 2].tick_) + "\n");
+    }
+    if (!vEnd)
+        throw std::runtime_error("Input log " + path + " has no end (run interrupted ?)\n");
+}
+//*****************************************************************************
+// ********************************** GROUND **********************************
+//*****************************************************************************
+ground::ground(SDL_Surface* window_surface_ptr, int nThreads, uint64_t seed, const simulationParams& params):
+    window_surface_ptr_{window_surface_ptr},
+    params_{params},
+    preyGrid_(grid_cell_size, params.worldWidth, params.worldHeight),
+    wolfGrid_(grid_cell_size, params.worldWidth, params.worldHeight),
+    dogGrid_(grid_cell_size, params.worldWidth, params.worldHeight),
+    chunks_(params.worldWidth, params.worldHeight),
+    pool_(nThreads)
+{
+    this->image_ptr_ = NULL;
+    this->background_ = NULL;
+    this->fullRedraw_ = true;
+    this->presentAll_ = true;
+    this->stats_ = {};
+    this->keys_ = 0;
+    this->cameraX_ = 0;
+    this->cameraY_ = 0;
+    this->cameraFollow_ = true;
+    this->panX_ = 0;
+    this->panY_ = 0;
+    this->gridsValid_ = false;
+    this->newTimers_.resize(this->pool_.getThreadCount());
+    this->params_.validate();
+    this->store_.setWorld(params.worldWidth, params.worldHeight);
+    this->store_.sheeps_.totalVelocity_ = params.sheepVelocity;
+    this->store_.wolves_.totalVelocity_ = params.wolfVelocity;
+    this->store_.dogs_.totalVelocity_ = params.dogVelocity;
+    this->store_.shepherds_.totalVelocity_ = params.shepherdVelocity;
+    this->store_.setSeed(seed);
+    this->sheepAnimation_ = NULL;
+    this->wolfAnimation_ = NULL;
+    if (window_surface_ptr == NULL)
+        return;
+    this->sheepAnimation_ = spriteAtlas::addAnimations("sheep", sheep::getPaths(), sheep::FrameInterval, window_surface_ptr);
+    this->wolfAnimation_ = spriteAtlas::addAnimations("wolf", wolf::getPaths(), wolf::FrameInterval, window_surface_ptr);
+    //Le fond ne change jamais : les tuiles d'herbe sont collees une seule fois, sur
+    //une tuile de plus que la fenetre pour suivre la camera (voir drawGround)
+    this->image_ptr_ = spriteAtlas::getSurface("media/grass.png", window_surface_ptr);
+    this->background_ = SDL_CreateRGBSurfaceWithFormat(0, window_surface_ptr->w + grass_width, window_surface_ptr->h + grass_height, 32, window_surface_ptr->format->format);
+    if (!this->background_)
+        throw std::runtime_error(std::string(SDL_GetError()));
+    for (int y = 0; y < this->background_->h; y += grass_height)
+    {
+        for (int x = 0; x < this->background_->w; x += grass_width)
+        {
+            SDL_Rect vRect = { x, y, 0 , 0 };
+            SDL_BlitSurface(this->image_ptr_, NULL, this->background_, &vRect);
+        }
+    }
 }
 /////////////////////////////////////////////
-bool renderedObject::theresOverlap(renderedObject* vO2)
+ground::~ground()
 {
-    return!((this->getXBox() > vO2->getXBox() + vO2->getWidthBox())
-         || (this->getXBox() + this->getWidthBox() < vO2->getXBox())
-         || (this->getYBox() > vO2->getYBox() + vO2->getHeightBox())
-         || (this->getYBox() + this->getHeightBox() < vO2->getYBox()));
+    this->store_.deleteViews();
+    if (this->background_ != NULL)
+        SDL_FreeSurface(this->background_);
 }
 /////////////////////////////////////////////
-bool renderedObject::hasInside(int x, int y)
+int ground::spawn(speciesTable& pTable, int x, int y, uint32_t properties, renderedObject* view)
 {
-    return (this->x_ <= x) && (this->x_ + this->width_ >= x)
-        && (this->y_ <= y) && (this->y_ + this->height_ >= y);
+    //Tous les tirages de la naissance passent par le generateur de la nouvelle entite
+    int i = pTable.add(this->store_.nextId_++, x, y, properties, view);
+    if (x == random_position)
+    {
+        pTable.x_[i] = pTable.random(i) % (pTable.worldWidth_ - pTable.width_);
+        pTable.y_[i] = pTable.random(i) % (pTable.worldHeight_ - pTable.height_);
+    }
+    this->gridsValid_ = false;
+    pTable.setRandomVelocitys(i);
+    return i;
 }
 /////////////////////////////////////////////
-void renderedObject::draw()
+renderedObject* ground::newView(speciesTable& pTable)
 {
-    //La position (et pas la taille) de ce rectangle définie l'endroit ou la surface est collée
-    SDL_Rect vRect = { (int)this->x_, (int)this->y_,0, 0 };
-    SDL_BlitSurface(this->image_ptr_, NULL, this->window_surface_ptr_, &vRect);
+    //Moutons et loups sont dessines depuis l'atlas par animate, sans objet
+    if (this->window_surface_ptr_ == NULL || &pTable == &this->store_.sheeps_ || &pTable == &this->store_.wolves_)
+        return NULL;
+    if (&pTable == &this->store_.dogs_)
+        return new dog(this->window_surface_ptr_);
+    return new shepherd(this->window_surface_ptr_);
 }
-//*****************************************************************************
-// ****************************** MOVING OBJECT *******************************
-//*****************************************************************************
-movingObject::movingObject(int totalVelocity)
+/////////////////////////////////////////////
+void ground::addSheep(int x, int y)
 {
-    this->totalVelocity_ = totalVelocity;
-    this->setRandomVelocitys();
+    speciesTable& vSheeps = this->store_.sheeps_;
+    int i = this->spawn(vSheeps, x, y, propertieBit(propertie::sheep) | propertieBit(propertie::prey), this->newView(vSheeps));
+    propertie vGender[] = { propertie::male,propertie::female };
+    int vGenderNbr = vSheeps.random(i) % 2;
+    vSheeps.addPropertie(i, vGender[vGenderNbr]);
+    //Sprint et accouplement possibles des la premiere mise a jour
+    vSheeps.cooldown_[i] = vSheeps.tick_ + 1;
+    vSheeps.procreateTime_[i] = vSheeps.tick_ + 1;
+    this->timers_.schedule(vSheeps.cooldown_[i], vSheeps.id_[i], timerKind::boostReady);
+    this->timers_.schedule(vSheeps.procreateTime_[i], vSheeps.id_[i], timerKind::procreateReady);
 }
+void ground::addSheep() { this->addSheep(random_position, random_position); }
 /////////////////////////////////////////////
-bool movingObject::canMoveX() { return (this->getXBox() + this->xVelocity_ + this->getWidthBox() < frame_width) && (this->getXBox() + this->xVelocity_ > 0); }
-bool movingObject::canMoveY() { return (this->getYBox() + this->yVelocity_ + this->getHeightBox() < frame_height) && (this->getYBox() + this->yVelocity_ > 0); }
+void ground::addWolf()
+{
+    speciesTable& vWolves = this->store_.wolves_;
+    int i = this->spawn(vWolves, random_position, random_position, propertieBit(propertie::wolf), this->newView(vWolves));
+    vWolves.lifeTime_[i] = vWolves.tick_ + this->params_.wolfLifeTime;
+    this->timers_.schedule(vWolves.lifeTime_[i], vWolves.id_[i], timerKind::starve);
+}
 /////////////////////////////////////////////
-void movingObject::goToward(renderedObject* vMO) { this->goToward(vMO->getXBox(), vMO->getYBox()); }
-void movingObject::goToward(int x, int y)
+void ground::addDog()
 {
-    this->xVelocity_ = x - this->getXBox();
-    this->yVelocity_ = y - this->getYBox();
-    this->adjustVelocitys();
+    this->spawn(this->store_.dogs_, random_position, random_position, propertieBit(propertie::dog), this->newView(this->store_.dogs_));
 }
 /////////////////////////////////////////////
-void movingObject::runAway(renderedObject* vMO) { this->runAway(vMO->getXBox(), vMO->getYBox()); }
-void movingObject::runAway(int x, int y)
+void ground::addShepherd()
 {
-    this->xVelocity_ =  this->getXBox() - x;
-    this->yVelocity_ = this->getYBox() - y;
-    this->adjustVelocitys();
+    this->spawn(this->store_.shepherds_, this->params_.worldWidth / 2, this->params_.worldHeight / 2, propertieBit(propertie::shepherd), this->newView(this->store_.shepherds_));
 }
 /////////////////////////////////////////////
-void movingObject::setRandomVelocitys()
+int ground::getScore()
 {
-    this->xVelocity_ = (rand() % this->totalVelocity_ * 2) - this->totalVelocity_;
-    if (!canMoveX())
-        this->xVelocity_ = -this->xVelocity_;
-    this->yVelocity_ = (((rand() % 1) * 2) - 1) * (this->totalVelocity_ - abs(this->xVelocity_));
-    if (!canMoveY())
-        this->yVelocity_ = -this->yVelocity_;
+    return this->store_.sheeps_.size();
 }
+populationStats ground::getStats()
+{
+    this->stats_.tick_ = this->getTick();
+    this->stats_.sheep_ = this->store_.sheeps_.size();
+    this->stats_.wolves_ = this->store_.wolves_.size();
+    return this->stats_;
+}
+uint64_t ground::getTick() { return this->store_.sheeps_.tick_; }
+entityStore& ground::getStore() { return this->store_; }
 /////////////////////////////////////////////
-void movingObject::adjustVelocitys()
+bool ground::saveCheckpoint(const std::string& path)
 {
-    //Hors map
-    while (!canMoveX() && this->xVelocity_ != 0)
-        this->xVelocity_ -= (this->xVelocity_ > 0 ? 1 : -1);
-    while (!canMoveY() && this->yVelocity_ != 0)
-        this->yVelocity_ -= (this->yVelocity_ > 0 ? 1 : -1);
-    //Vitesse trop élevé
-    while (abs(this->xVelocity_) + abs(this->yVelocity_) > abs(this->totalVelocity_))
+    PROFILE_PHASE("saveCheckpoint");
+    //Copie de l'etat en un bloc sur le thread du tick, l'ecriture est faite ailleurs
+    speciesTable* vTables[] = { &this->store_.sheeps_, &this->store_.wolves_, &this->store_.dogs_, &this->store_.shepherds_ };
+    size_t vSize = sizeof(checkpointHeader);
+    for (speciesTable* vTable : vTables)
+        vSize += sizeof(checkpointTable) + getTableBytes(*vTable, vTable->size());
+    std::vector<uint32_t>* vChunkColumns[] = { &this->chunks_.active_, &this->chunks_.quiet_ };
+    vSize += 2 * getColumnBytes(this->chunks_.size());
+    std::vector<char> vData(vSize, 0);
+    checkpointHeader vHeader;
+    memcpy(vHeader.magic_, checkpoint_magic, sizeof(vHeader.magic_));
+    vHeader.version_ = checkpoint_version;
+    vHeader.byteOrder_ = checkpoint_byte_order;
+    vHeader.size_ = vSize;
+    vHeader.nextId_ = this->store_.nextId_;
+    vHeader.tableCount_ = 4;
+    vHeader.worldWidth_ = this->params_.worldWidth;
+    vHeader.worldHeight_ = this->params_.worldHeight;
+    vHeader.chunkCount_ = this->chunks_.size();
+    vHeader.lodPeriod_ = this->params_.lodPeriod;
+    vHeader.births_ = this->stats_.births_;
+    vHeader.kills_ = this->stats_.kills_;
+    vHeader.starvations_ = this->stats_.starvations_;
+    memcpy(vData.data(), &vHeader, sizeof(vHeader));
+    size_t vOffset = sizeof(vHeader);
+    for (speciesTable* vTable : vTables)
     {
-        this->xVelocity_ -= (this->xVelocity_ > 0 ? 1 : -1);
-        if (abs(this->xVelocity_) + abs(this->yVelocity_) > abs(this->totalVelocity_))
-            this->yVelocity_ -= (this->yVelocity_ > 0 ? 1 : -1);
+        checkpointTable vTableHeader = { (uint32_t)vTable->size(), getColumnCount(*vTable), vTable->width_, vTable->height_,
+                                         vTable->totalVelocity_, 0, vTable->seed_, vTable->tick_ };
+        memcpy(vData.data() + vOffset, &vTableHeader, sizeof(vTableHeader));
+        vOffset += sizeof(vTableHeader);
+        forEachColumn(*vTable, [&](auto& vColumn) {
+            memcpy(vData.data() + vOffset, vColumn.data(), vColumn.size() * sizeof(vColumn[0]));
+            vOffset += getColumnBytes((uint32_t)vColumn.size(), sizeof(vColumn[0]));
+        });
     }
-    //Vitesse trop faible
-    if (abs(this->xVelocity_) + abs(this->yVelocity_) < abs(this->totalVelocity_))
-        this->setRandomVelocitys();
+    for (std::vector<uint32_t>* vColumn : vChunkColumns)
+    {
+        memcpy(vData.data() + vOffset, vColumn->data(), vColumn->size() * 4);
+        vOffset += getColumnBytes((uint32_t)vColumn->size());
+    }
+    return this->writer_.push(path, std::move(vData));
 }
 /////////////////////////////////////////////
-void movingObject::interact(renderedObject* pO2)
+void ground::loadCheckpoint(const std::string& path)
 {
-
-    if (this->hasPropertie("wolf"))
+    mappedFile vFile(path);
+    const char* vData = vFile.getData();
+    checkpointHeader vHeader;
+    if (vFile.getSize() < sizeof(vHeader))
+        throw std::runtime_error("Truncated checkpoint " + path + "\n");
+    memcpy(&vHeader, vData, sizeof(vHeader));
+    if (memcmp(vHeader.magic_, checkpoint_magic, sizeof(vHeader.magic_)) != 0)
+        throw std::runtime_error("Not a checkpoint " + path + "\n");
+    if (vHeader.byteOrder_ != checkpoint_byte_order)
+        throw std::runtime_error("Checkpoint " + path + " was written with another byte order\n");
+    if (vHeader.version_ != checkpoint_version)
+        throw std::runtime_error("Checkpoint " + path + " has version " + std::to_string(vHeader.version_) + ", expected " + std::to_string(checkpoint_version) + "\n");
+    if (vHeader.worldWidth_ != this->params_.worldWidth || vHeader.worldHeight_ != this->params_.worldHeight)
+        throw std::runtime_error("Checkpoint " + path + " has a " + std::to_string(vHeader.worldWidth_) + "x" + std::to_string(vHeader.worldHeight_) + " world (see --world)\n");
+    if (vHeader.lodPeriod_ != this->params_.lodPeriod)
+        throw std::runtime_error("Checkpoint " + path + " has a LOD period of " + std::to_string(vHeader.lodPeriod_) + " ticks (see --lod)\n");
+    if (vHeader.size_ != vFile.getSize() || vHeader.tableCount_ != 4 || vHeader.chunkCount_ != (uint32_t)this->chunks_.size())
+        throw std::runtime_error("Corrupted checkpoint " + path + "\n");
+    //On ne touche a l'etat qu'une fois tout le fichier verifie
+    entityStore vStore;
+    speciesTable* vTables[] = { &vStore.sheeps_, &vStore.wolves_, &vStore.dogs_, &vStore.shepherds_ };
+    size_t vOffset = sizeof(vHeader);
+    for (speciesTable* vTable : vTables)
     {
-        if (pO2->hasPropertie("dog") && this->getDistance(pO2) < 150)
-        {
-            this->addPropertie("scared");
-            this->runAway(pO2);
-        }
-        else if (pO2->hasPropertie("prey") && this->theresOverlap(pO2))
-        {
-            this->addPropertie("full");
-            pO2->addPropertie("dead");
-        }
-        else if (pO2->hasPropertie("prey") && !this->hasPropertie("scared"))
-        {
-            wolf* vW = (wolf*)this;
-            vW->choosePrey(pO2);
-        }
+        checkpointTable vTableHeader;
+        if (vOffset + sizeof(vTableHeader) > vFile.getSize())
+            throw std::runtime_error("Corrupted checkpoint " + path + "\n");
+        memcpy(&vTableHeader, vData + vOffset, sizeof(vTableHeader));
+        vOffset += sizeof(vTableHeader);
+        if (vTableHeader.columnCount_ != getColumnCount(*vTable)
+            || vOffset + getTableBytes(*vTable, vTableHeader.count_) > vFile.getSize())
+            throw std::runtime_error("Corrupted checkpoint " + path + "\n");
+        vTable->width_ = vTableHeader.width_;
+        vTable->height_ = vTableHeader.height_;
+        vTable->totalVelocity_ = vTableHeader.totalVelocity_;
+        vTable->seed_ = vTableHeader.seed_;
+        vTable->tick_ = vTableHeader.tick_;
+        forEachColumn(*vTable, [&](auto& vColumn) {
+            vColumn.resize(vTableHeader.count_);
+            memcpy(vColumn.data(), vData + vOffset, vColumn.size() * sizeof(vColumn[0]));
+            vOffset += getColumnBytes(vTableHeader.count_, sizeof(vColumn[0]));
+        });
     }
-    else if (this->hasPropertie("prey") && pO2->hasPropertie("wolf") && this->getDistance(pO2) < 200)
+    if (vOffset + 2 * getColumnBytes(vHeader.chunkCount_) > vFile.getSize())
+        throw std::runtime_error("Corrupted checkpoint " + path + "\n");
+    std::vector<uint32_t> vActive(vHeader.chunkCount_);
+    std::vector<uint32_t> vQuiet(vHeader.chunkCount_);
+    for (std::vector<uint32_t>* vColumn : { &vActive, &vQuiet })
     {
-        this->runAway(pO2);
-        if (this->removePropertie("canboost"))
-            this->addPropertie("boost");
+        memcpy(vColumn->data(), vData + vOffset, vColumn->size() * 4);
+        vOffset += getColumnBytes(vHeader.chunkCount_);
     }
-    else if (this->hasPropertie("dog") && !this->hasPropertie("go") && pO2->hasPropertie("shepherd") && this->getDistance(pO2) > 100)
-        this->goToward(pO2);
-    else if (this->hasPropertie("canprocreate") && this->hasPropertie("male")
-        && pO2->hasPropertie("canprocreate") && pO2->hasPropertie("female") && this->theresOverlap(pO2))
-    { 
-        this->removePropertie("canprocreate"); 
-        pO2->removePropertie("canprocreate");
-        this->addPropertie("hasprocreate");
-        pO2->addPropertie("hasprocreate");
-        pO2->addPropertie("pregnant");
+    vStore.nextId_ = vHeader.nextId_;
+    this->chunks_.active_ = vActive;
+    this->chunks_.quiet_ = vQuiet;
+    this->stats_.births_ = vHeader.births_;
+    this->stats_.kills_ = vHeader.kills_;
+    this->stats_.starvations_ = vHeader.starvations_;
+    this->store_.deleteViews();
+    this->store_ = vStore;
+    this->store_.setWorld(this->params_.worldWidth, this->params_.worldHeight);
+    this->scheduleTimers();
+    for (speciesTable* vTable : { &this->store_.sheeps_, &this->store_.wolves_, &this->store_.dogs_, &this->store_.shepherds_ })
+    {
+        vTable->views_.assign(vTable->size(), NULL);
+        vTable->frame_.assign(vTable->size(), 0);
+        vTable->frameWait_.assign(vTable->size(), 0);
+        for (int i = 0; i < vTable->size(); i++)
+            vTable->views_[i] = this->newView(*vTable);
     }
+    this->fullRedraw_ = true;
+    this->gridsValid_ = false;
 }
-//*****************************************************************************
-// ***************************** ANIMATED OBJECT ******************************
-//*****************************************************************************
-animatedObject::animatedObject(int frameInterval)
+/////////////////////////////////////////////
+void ground::waitCheckpoints() { this->writer_.wait(); }
+/////////////////////////////////////////////
+void ground::step()
+{
+    PROFILE_PHASE("step");
+    this->updateObjects();
+    this->removeDeads();
+    this->addNews();
+    this->buildGrids();//Pour l'affichage de cet etat et le prochain pas
+}
+/////////////////////////////////////////////
+void ground::render()
+{
+    if (this->window_surface_ptr_ == NULL)
+        return;
+    PROFILE_PHASE("render");
+    this->updateCamera();
+    this->dirtyRects_.clear();
+    this->presentAll_ = this->fullRedraw_;
+    this->drawGround();
+    this->drawObjects();
+    this->fullRedraw_ = false;
+    //Scene dense : une seule copie de la fenetre coute moins que des milliers de rectangles
+    long long vArea = 0;
+    for (const SDL_Rect& vRect : this->dirtyRects_)
+        vArea += (long long)vRect.w * vRect.h;
+    if (vArea > (long long)this->window_surface_ptr_->w * this->window_surface_ptr_->h / 2)
+        this->presentAll_ = true;
+}
+/////////////////////////////////////////////
+void ground::present(SDL_Window* window_ptr)
 {
-    this->frameInterval_ = frameInterval;
-    this->frameDuration_ = frameInterval;
-    this->frameIndex_ = 0;
+    if (this->presentAll_)
+        SDL_UpdateWindowSurface(window_ptr);
+    else if (!this->dirtyRects_.empty())
+        SDL_UpdateWindowSurfaceRects(window_ptr, this->dirtyRects_.data(), (int)this->dirtyRects_.size());
 }
 /////////////////////////////////////////////
-void animatedObject::setSurfaceMap()
+void ground::drawGround()
 {
-    this->images_ = {};
-    std::map<std::string, std::vector<std::string>> pathMap = this->getPathMap();
-    std::map<std::string, std::vector<std::string>>::iterator it;
-    for (it = pathMap.begin(); it != pathMap.end(); it++)
+    PROFILE_PHASE("drawGround");
+    //Le fond est periodique : decale du reste de la camera par la taille d'une tuile
+    int vXOffset = this->cameraX_ % grass_width;
+    int vYOffset = this->cameraY_ % grass_height;
+    if (this->fullRedraw_)
+    {
+        SDL_Rect vSource = { vXOffset, vYOffset, this->window_surface_ptr_->w, this->window_surface_ptr_->h };
+        SDL_BlitSurface(this->background_, &vSource, this->window_surface_ptr_, NULL);
+        this->drawnRects_.clear();
+        return;
+    }
+    //On n'efface que la ou des sprites ont ete dessines a l'image precedente
+    for (const SDL_Rect& vDrawn : this->drawnRects_)
     {
-        std::string vKey = it->first;
-        std::vector<std::string> vPaths = it->second;
-        std::vector<SDL_Surface*> vSurfaces = {};
-        for (std::string vPath : vPaths)
-            vSurfaces.push_back(load_surface_for(vPath, this->window_surface_ptr_));
-        this->images_.insert({ vKey,vSurfaces });
+        SDL_Rect vSource = { vDrawn.x + vXOffset, vDrawn.y + vYOffset, vDrawn.w, vDrawn.h };
+        SDL_Rect vDestination = vDrawn;
+        SDL_BlitSurface(this->background_, &vSource, this->window_surface_ptr_, &vDestination);
+        this->dirtyRects_.push_back(vDrawn);
     }
+    this->drawnRects_.clear();
 }
 /////////////////////////////////////////////
-void animatedObject::updateFrameDuration()
+void ground::drawObjects()
 {
-    this->frameDuration_++;
-    if (this->frameDuration_ >= this->frameInterval_)
+    PROFILE_PHASE("drawObjects");
+    this->batch_.clear();
+    this->batch_.setOrigin(this->cameraX_, this->cameraY_);
+    //Seules les entites dans la fenetre sont visitees, via les grilles
+    if (!this->gridsValid_)
+        this->buildGrids();
+    std::vector<int>& vVisible = this->visible_;
+    this->queryVisible(this->preyGrid_, this->store_.sheeps_, vVisible);
+    this->animate(this->store_.sheeps_, vVisible, *this->sheepAnimation_);
+    this->queryVisible(this->wolfGrid_, this->store_.wolves_, vVisible);
+    this->animate(this->store_.wolves_, vVisible, *this->wolfAnimation_);
+    vVisible.resize(this->store_.shepherds_.size());
+    std::iota(vVisible.begin(), vVisible.end(), 0);
+    updateViews<shepherd>(this->store_.shepherds_, vVisible, this->batch_);
+    this->queryVisible(this->dogGrid_, this->store_.dogs_, vVisible);
+    updateViews<dog>(this->store_.dogs_, vVisible, this->batch_);
+    this->batch_.draw(this->window_surface_ptr_, this->pool_);
+    //Sprites et cadres a effacer a l'image suivante
+    SDL_Rect vWindow = { 0, 0, this->window_surface_ptr_->w, this->window_surface_ptr_->h };
+    for (const spriteDraw& vSprite : this->batch_.getSprites())
     {
-        this->nextFrame();
-        this->frameDuration_ = 0;
+        SDL_Rect vRect;
+        if (!SDL_IntersectRect(&vSprite.rect_, &vWindow, &vRect))
+            continue;
+        this->drawnRects_.push_back(vRect);
+        this->dirtyRects_.push_back(vRect);
     }
 }
 /////////////////////////////////////////////
-void animatedObject::nextFrame()
+void ground::updateObjects()
 {
-    std::string imageKey = this->getImageKey();
-    this->frameIndex_++;
-    if (this->frameIndex_ >= this->images_.at(imageKey).size())
-        this->frameIndex_ = 0;
-    this->image_ptr_ = this->images_.at(imageKey)[this->frameIndex_];
+    //Chaque entite lit store_ (tick precedent) et n'ecrit que sa propre entree
+    //de next_ : le resultat ne depend ni du nombre de threads ni de l'ordre
+    PROFILE_PHASE("updateObjects");
+    if (!this->gridsValid_)
+        this->buildGrids();
+    this->next_ = this->store_;
+    this->next_.nextTick();
+    //Regions suivant les bergers et non la camera libre : un replay ou un
+    //instantane donne le meme niveau de detail quel que soit l'affichage
+    speciesTable& vSheeps = this->store_.sheeps_;
+    this->chunks_.update(this->store_.shepherds_, this->store_.wolves_);
+    this->sheepSteps_.resize(vSheeps.size());
+    for (int i = 0; i < vSheeps.size(); i++)
+        this->sheepSteps_[i] = this->chunks_.getStep(this->chunks_.getChunk(vSheeps.getXBox(i), vSheeps.getYBox(i)), vSheeps.tick_, this->params_.lodPeriod);
+    this->findMates();
+    {
+        PROFILE_PHASE("updateSheep");
+        this->pool_.parallelFor(vSheeps.size(), [this](int begin, int end) {
+            for (int i = begin; i < end; i++)
+                if (this->sheepSteps_[i] != 0)
+                    this->updateSheep(i, this->sheepSteps_[i]);
+        });
+    }
+    {
+        PROFILE_PHASE("updateWolf");
+        this->pool_.parallelFor(this->store_.wolves_.size(), [this](int begin, int end) {
+            for (int i = begin; i < end; i++)
+                this->updateWolf(i);
+        });
+    }
+    this->updateShepherds();
+    this->updateDogs();
+    this->fireTimers();
+    std::swap(this->store_, this->next_);
+    this->gridsValid_ = false;
 }
-//*****************************************************************************
-// ********************************* SHEPERD **********************************
-//*****************************************************************************
-int shepherd::ImgW = 49;
-int shepherd::ImgH = 49;
-shepherd::shepherd(SDL_Surface* window_surface_ptr) :
-    renderedObject("media/shepherd.png", window_surface_ptr, shepherd::ImgW, shepherd::ImgH, frame_width / 2, frame_height / 2), movingObject(4)
+/////////////////////////////////////////////
+void ground::animate(speciesTable& pTable, const std::vector<int>& pIndices, const animationTable& pAnimation)
 {
-    this->properties_ = { "shepherd" };
+    //Une passe sur les compteurs des entites visibles : la direction n'est lue
+    //que quand l'image change, comme avant avec getImageKey
+    int vCount = pAnimation.frameCount_;
+    for (int i : pIndices)
+    {
+        if (pTable.frameWait_[i]-- > 0)
+            continue;
+        pTable.frameWait_[i] = pAnimation.frameInterval_ - 1;
+        int vNext = pTable.frame_[i] % vCount + 1;
+        int vDirection = static_cast<int>(getDirection(pTable.xVelocity_[i], pTable.yVelocity_[i]));
+        pTable.frame_[i] = vDirection * vCount + (vNext < vCount ? vNext : 0);
+    }
+    for (int i : pIndices)
+        this->batch_.addSprite(pAnimation.frames_[pTable.frame_[i]], pTable.x_[i], pTable.y_[i]);
 }
 /////////////////////////////////////////////
-void shepherd::update()
+void ground::queryVisible(spatialGrid& pGrid, speciesTable& pTable, std::vector<int>& out)
 {
-    this->move();
-    this->draw();
+    //La grille range les coins de hitbox : marge d'un sprite autour de la fenetre
+    int vLeft = this->cameraX_;
+    int vTop = this->cameraY_;
+    int vRight = vLeft + this->window_surface_ptr_->w;
+    int vBottom = vTop + this->window_surface_ptr_->h;
+    out.clear();
+    pGrid.query(vLeft - pTable.width_, vTop - pTable.height_, vRight + pTable.width_, vBottom + pTable.height_, out);
+    //Ordre des index, comme sans decoupage : meme ordre de dessin a profondeur egale
+    std::sort(out.begin(), out.end());
+    out.erase(std::remove_if(out.begin(), out.end(), [&](int i) {
+        return pTable.x_[i] + pTable.width_ <= vLeft || pTable.x_[i] >= vRight
+            || pTable.y_[i] + pTable.height_ <= vTop || pTable.y_[i] >= vBottom;
+    }), out.end());
 }
 /////////////////////////////////////////////
-void shepherd::move()
+void ground::updateCamera()
 {
-    const uint8_t* keystate = SDL_GetKeyboardState(0);
-    //Horizontal
-    if (keystate[SDL_SCANCODE_LEFT]) { this->xVelocity_ = -this->totalVelocity_; }
-    else if (keystate[SDL_SCANCODE_RIGHT]) { this->xVelocity_ = this->totalVelocity_; }
-    else { this->xVelocity_ = 0; }
-    if(canMoveX())
-        this->x_ += this->xVelocity_;
-    //Vertical
-    if (keystate[SDL_SCANCODE_UP]) { this->yVelocity_ = -this->totalVelocity_; }
-    else if (keystate[SDL_SCANCODE_DOWN]) { this->yVelocity_ = this->totalVelocity_; }
-    else { this->yVelocity_ = 0; }
-    if (canMoveY())
-        this->y_ += this->yVelocity_;
+    int vWidth = this->window_surface_ptr_->w;
+    int vHeight = this->window_surface_ptr_->h;
+    int vX = this->cameraX_ + this->panX_;
+    int vY = this->cameraY_ + this->panY_;
+    this->panX_ = 0;
+    this->panY_ = 0;
+    speciesTable& vShepherds = this->store_.shepherds_;
+    if (this->cameraFollow_ && vShepherds.size() > 0)
+    {
+        vX = vShepherds.x_[0] + vShepherds.width_ / 2 - vWidth / 2;
+        vY = vShepherds.y_[0] + vShepherds.height_ / 2 - vHeight / 2;
+    }
+    //Jamais hors du monde ; un monde plus petit que la fenetre reste en (0, 0)
+    vX = std::max(0, std::min(vX, this->params_.worldWidth - vWidth));
+    vY = std::max(0, std::min(vY, this->params_.worldHeight - vHeight));
+    //Tout bouge a l'ecran : les rectangles sales ne suffisent plus
+    if (vX != this->cameraX_ || vY != this->cameraY_)
+        this->fullRedraw_ = true;
+    this->cameraX_ = vX;
+    this->cameraY_ = vY;
 }
-//*****************************************************************************
-//************************************ DOG ************************************
-//*****************************************************************************
-int dog::ImgW = 49;
-int dog::ImgH = 49;
-dog::dog(SDL_Surface* window_surface_ptr) :
-    renderedObject("media/dog.png", window_surface_ptr, dog::ImgW, dog::ImgH, (rand() % (frame_width - dog::ImgW)), (rand() % (frame_height - dog::ImgH))) , movingObject(3)
+/////////////////////////////////////////////
+void ground::panCamera(int dx, int dy)
 {
-    this->properties_ = { "dog"};
+    //Applique, borne, au prochain render (updateCamera)
+    this->cameraFollow_ = false;
+    this->panX_ += dx;
+    this->panY_ += dy;
 }
 /////////////////////////////////////////////
-void dog::setXTarget(int x){int vXMax = frame_width - this->width_; this->xTarget_ = std::min(vXMax, x);}
-void dog::setYTarget(int y) {int vYMax = frame_height - this->height_;this->yTarget_ = std::min(vYMax, y);}
+void ground::followShepherd() { this->cameraFollow_ = true; }
 /////////////////////////////////////////////
-void dog::update()
+SDL_Point ground::toWorld(const SDL_Point& pScreen) { return { pScreen.x + this->cameraX_, pScreen.y + this->cameraY_ }; }
+/////////////////////////////////////////////
+void ground::buildGrids()
 {
-    this->updateTarget();
-    this->move();
-    this->draw();
+    PROFILE_PHASE("buildGrids");
+    speciesTable& vSheeps = this->store_.sheeps_;
+    speciesTable& vWolves = this->store_.wolves_;
+    speciesTable& vDogs = this->store_.dogs_;
+    this->preyGrid_.clear();
+    this->wolfGrid_.clear();
+    this->dogGrid_.clear();
+    for (int i = 0; i < vSheeps.size(); i++)
+        this->preyGrid_.insert(i, vSheeps.getXBox(i), vSheeps.getYBox(i));
+    for (int i = 0; i < vWolves.size(); i++)
+        this->wolfGrid_.insert(i, vWolves.getXBox(i), vWolves.getYBox(i));
+    for (int i = 0; i < vDogs.size(); i++)
+        this->dogGrid_.insert(i, vDogs.getXBox(i), vDogs.getYBox(i));
+    this->gridsValid_ = true;
 }
 /////////////////////////////////////////////
-void dog::move()
-{ 
-    if (!canMoveX() || !canMoveY())
-        this->setRandomVelocitys();
-    this->x_ += this->xVelocity_;
-    this->y_ += this->yVelocity_;
+void ground::findMates()
+{
+    PROFILE_PHASE("findMates");
+    //Chaque male disponible choisit la premiere femelle disponible qu'il touche,
+    //puis chaque femelle garde le premier male qui l'a choisie
+    speciesTable& vSheeps = this->store_.sheeps_;
+    int vOverlap = grid_max_box + grid_slack;
+    this->mates_.assign(vSheeps.size(), -1);
+    this->pool_.parallelFor(vSheeps.size(), [&](int begin, int end) {
+        thread_local std::vector<int> vNeighbours;
+        for (int i = begin; i < end; i++)
+        {
+            if (!vSheeps.hasPropertie(i, propertie::male) || !vSheeps.hasPropertie(i, propertie::canprocreate) || this->sheepSteps_[i] == 0)
+                continue;
+            int vX = vSheeps.getXBox(i);
+            int vY = vSheeps.getYBox(i);
+            vNeighbours.clear();
+            this->preyGrid_.query(vX - vOverlap, vY - vOverlap, vX + vOverlap, vY + vOverlap, vNeighbours);
+            std::sort(vNeighbours.begin(), vNeighbours.end());
+            for (int j : vNeighbours)
+            {
+                if (vSheeps.hasPropertie(j, propertie::canprocreate) && vSheeps.hasPropertie(j, propertie::female)
+                    && this->sheepSteps_[j] != 0 && vSheeps.theresOverlap(i, vSheeps, j))
+                {
+                    this->mates_[i] = j;
+                    break;
+                }
+            }
+        }
+    });
+    //Resolution des conflits dans l'ordre des index : deterministe
+    for (int i = 0; i < vSheeps.size(); i++)
+    {
+        int j = this->mates_[i];
+        if (j == -1 || !vSheeps.hasPropertie(i, propertie::male))
+            continue;
+        if (this->mates_[j] == -1)
+            this->mates_[j] = i;
+        else
+            this->mates_[i] = -1;
+    }
 }
 /////////////////////////////////////////////
-void dog::updateTarget()
+void ground::updateSheep(int i, int dt)
 {
-    if (this->hasPropertie("go") && abs(this->x_ - this->xTarget_) < 18 && abs(this->y_ - this->yTarget_) <18)
-        this->removePropertie("go");
-    else if (this->hasPropertie("go"))
-        this->goToward(this->xTarget_, this->yTarget_);
-    SDL_Rect vRect = { this->x_ - 2,this->y_ - 2, this->width_ + 4,this->height_ + 4 };
-    if (this->hasPropertie("clicked"))
-        SDL_FillRect(this->window_surface_ptr_, &vRect, 0xFF0000);
-    if (this->hasPropertie("go"))
-        SDL_FillRect(this->window_surface_ptr_, &vRect, 0x0080FF);
+    speciesTable& vSheeps = this->next_.sheeps_;
+    speciesTable& vWolves = this->store_.wolves_;
+    thread_local std::vector<int> vNeighbours;
+    thread_local candidateBlock vBlock;
+    int vOverlap = grid_max_box + grid_slack;
+    int vFlee = this->params_.wolfFleeDistance + vOverlap;
+    int vFleeSquared = this->params_.wolfFleeDistance * this->params_.wolfFleeDistance;
+    int vX = vSheeps.getXBox(i);
+    int vY = vSheeps.getYBox(i);
+    //Fuit les loups proches, le dernier dans l'ordre l'emporte. Un loup qui le touche le mange
+    vNeighbours.clear();
+    this->wolfGrid_.query(vX - vFlee, vY - vFlee, vX + vFlee, vY + vFlee, vNeighbours);
+    std::sort(vNeighbours.begin(), vNeighbours.end());
+    vBlock.measure(vWolves, vNeighbours, vX, vY);
+    for (int k = 0; k < (int)vNeighbours.size(); k++)
+    {
+        int j = vNeighbours[k];
+        if (vSheeps.theresOverlap(i, vWolves, j))
+            vSheeps.addPropertie(i, propertie::dead);
+        if (vBlock.distance_[k] < vFleeSquared)
+        {
+            vSheeps.runAway(i, vWolves.getXBox(j), vWolves.getYBox(j));
+            if (vSheeps.removePropertie(i, propertie::canboost))
+                vSheeps.addPropertie(i, propertie::boost);
+        }
+    }
+    //Accouplement decide par findMates
+    if (this->mates_[i] != -1)
+    {
+        vSheeps.removePropertie(i, propertie::canprocreate);
+        vSheeps.addPropertie(i, propertie::hasprocreate);
+        if (vSheeps.hasPropertie(i, propertie::female))
+            vSheeps.addPropertie(i, propertie::pregnant);
+    }
+    //Region endormie : dt pas d'un coup, sans loup ni partenaire entre deux. Les
+    //echeances tombent a leur tick meme quand le mouton n'est pas mis a jour
+    this->updateBoostTime(i);
+    this->updateProcreateTime(i);
+    for (int t = 0; t < dt; t++)
+        vSheeps.move(i);
 }
-//*****************************************************************************
-//*********************************** SHEEP ***********************************
-//*****************************************************************************
-int sheep::ImgW = 68;
-int sheep::ImgH = 60;
-sheep::sheep(SDL_Surface* window_surface_ptr, int x, int y) :
-    renderedObject("media/sheep.png", window_surface_ptr, sheep::ImgW, sheep::ImgH, x, y), animatedObject(10), movingObject(3)
+/////////////////////////////////////////////
+void ground::updateWolf(int i)
 {
-        this->cooldown_ = 0;
-        this->boostTime_ = 0;
-        this->procreateTime_ = 0;
-        std::string vGender[] = { "male","female" };
-        int vGenderNbr = rand() % 2;
-        this->properties_ = { "sheep","prey", vGender[vGenderNbr] };
-        this->setSurfaceMap();
+    speciesTable& vSheeps = this->store_.sheeps_;
+    speciesTable& vWolves = this->next_.wolves_;
+    speciesTable& vDogs = this->store_.dogs_;
+    thread_local std::vector<int> vNeighbours;
+    thread_local candidateBlock vBlock;
+    int vOverlap = grid_max_box + grid_slack;
+    int vScare = this->params_.dogScareDistance + vOverlap;
+    int vScareSquared = this->params_.dogScareDistance * this->params_.dogScareDistance;
+    int vX = vWolves.getXBox(i);
+    int vY = vWolves.getYBox(i);
+    //Fuit les chiens proches
+    vNeighbours.clear();
+    this->dogGrid_.query(vX - vScare, vY - vScare, vX + vScare, vY + vScare, vNeighbours);
+    std::sort(vNeighbours.begin(), vNeighbours.end());
+    vBlock.measure(vDogs, vNeighbours, vX, vY);
+    for (int k = 0; k < (int)vNeighbours.size(); k++)
+    {
+        int j = vNeighbours[k];
+        if (vBlock.distance_[k] < vScareSquared)
+        {
+            vWolves.addPropertie(i, propertie::scared);
+            vWolves.runAway(i, vDogs.getXBox(j), vDogs.getYBox(j));
+        }
+    }
+    //Rassasie s'il touche une proie (la proie se sait mangee dans updateSheep)
+    vNeighbours.clear();
+    this->preyGrid_.query(vX - vOverlap, vY - vOverlap, vX + vOverlap, vY + vOverlap, vNeighbours);
+    for (int j : vNeighbours)
+    {
+        if (vWolves.theresOverlap(i, vSheeps, j))
+        {
+            vWolves.addPropertie(i, propertie::full);
+            break;
+        }
+    }
+    //Chasse la proie la plus proche, a n'importe quelle distance
+    if (!vWolves.hasPropertie(i, propertie::scared))
+    {
+        int vPrey = this->trackPrey(i);
+        if (vPrey != -1)
+            vWolves.goToward(i, vSheeps.getXBox(vPrey), vSheeps.getYBox(vPrey));
+    }
+    vWolves.removePropertie(i, propertie::scared);
+    this->updateLifeTime(i);
+    vWolves.move(i);
 }
 /////////////////////////////////////////////
-    sheep::sheep(SDL_Surface * window_surface_ptr) :
-        sheep(window_surface_ptr, (rand() % (frame_width - sheep::ImgW)), (rand() % (frame_height - sheep::ImgH)))
-{}
-/////////////////////////////////////////////
-std::map<std::string, std::vector<std::string>> sheep::getPathMap()
+void ground::updateShepherds()
 {
-    std::string p = "media/sheeps/";
-    std::vector<std::string> vPNW = {};
-    std::vector<std::string> vPNE = {};
-    std::vector<std::string> vPSW = {};
-    std::vector<std::string> vPSE = {};
-    for (int i = 1; i <= 10; i++)
+    speciesTable& vShepherds = this->next_.shepherds_;
+    //keys_ vient du clavier ou d'un enregistrement (application::step)
+    for (int i = 0; i < vShepherds.size(); i++)
     {
-        vPNW.push_back(p + "nw (" + std::to_string(i) + ").png");
-        vPNE.push_back(p + "ne (" + std::to_string(i) + ").png");
-        vPSW.push_back(p + "sw (" + std::to_string(i) + ").png");
-        vPSE.push_back(p + "se (" + std::to_string(i) + ").png");
+        int& vXVelocity = vShepherds.xVelocity_[i];
+        int& vYVelocity = vShepherds.yVelocity_[i];
+        //Horizontal
+        if (this->keys_ & key_left) { vXVelocity = -vShepherds.totalVelocity_; }
+        else if (this->keys_ & key_right) { vXVelocity = vShepherds.totalVelocity_; }
+        else { vXVelocity = 0; }
+        if (vShepherds.canMoveX(i))
+            vShepherds.x_[i] += vXVelocity;
+        //Vertical
+        if (this->keys_ & key_up) { vYVelocity = -vShepherds.totalVelocity_; }
+        else if (this->keys_ & key_down) { vYVelocity = vShepherds.totalVelocity_; }
+        else { vYVelocity = 0; }
+        if (vShepherds.canMoveY(i))
+            vShepherds.y_[i] += vYVelocity;
     }
-    std::map<std::string, std::vector<std::string>> pathMap = { {"nw",vPNW},{"ne",vPNE},{"sw",vPSW},{"se",vPSE} };
-    return pathMap;
 }
 /////////////////////////////////////////////
-std::string sheep::getImageKey()
+void ground::updateDogs()
 {
-    if (this->xVelocity_ <= 0 && this->yVelocity_ >= 0) { return "sw"; }
-    if (this->xVelocity_ >= 0 && this->yVelocity_ >= 0) { return "se"; }
-    if (this->xVelocity_ <= 0 && this->yVelocity_ <= 0) { return "nw"; }
-    return "ne";
+    speciesTable& vDogs = this->next_.dogs_;
+    speciesTable& vShepherds = this->store_.shepherds_;
+    std::vector<int> vAll(vShepherds.size());
+    std::iota(vAll.begin(), vAll.end(), 0);
+    candidateBlock vBlock;
+    //Distance tronquee > F <=> distance au carre >= (F + 1)^2
+    int vFollowSquared = (this->params_.dogFollowDistance + 1) * (this->params_.dogFollowDistance + 1);
+    for (int i = 0; i < vDogs.size(); i++)
+    {
+        //Revient vers le berger s'il s'eloigne
+        vBlock.measure(vShepherds, vAll, vDogs.getXBox(i), vDogs.getYBox(i));
+        for (int j = 0; j < vShepherds.size(); j++)
+            if (!vDogs.hasPropertie(i, propertie::go) && vBlock.distance_[j] >= vFollowSquared)
+                vDogs.goToward(i, vShepherds.getXBox(j), vShepherds.getYBox(j));
+        this->updateTarget(i);
+        vDogs.move(i);
+    }
 }
 /////////////////////////////////////////////
-void sheep::update()
+int ground::findNearestPrey(int pWolf, int& distance)
 {
-    this->updateBoostTime();
-    this->updateProcreateTime();
-    this->move();
-    this->updateFrameDuration();
-    this->draw();
+    speciesTable& vSheeps = this->store_.sheeps_;
+    speciesTable& vWolves = this->store_.wolves_;
+    thread_local std::vector<int> vCandidates;
+    thread_local candidateBlock vBlock;
+    int vX = vWolves.getXBox(pWolf);
+    int vY = vWolves.getYBox(pWolf);
+    int vBest = -1;
+    int vBestDistance = 0;//Au carre
+    for (int vRing = 0; vRing <= this->preyGrid_.getMaxRing(); vRing++)
+    {
+        //Distance minimale d'une proie de cet anneau : on arrete quand on ne peut plus faire mieux
+        int vMinDistance = (vRing - 1) * this->preyGrid_.getCellSize() - grid_max_box - 2 * grid_slack;
+        if (vBest != -1 && vMinDistance > 0 && vMinDistance * vMinDistance > vBestDistance)
+            break;
+        vCandidates.clear();
+        this->preyGrid_.queryRing(vX, vY, vRing, vCandidates);
+        vBlock.measure(vSheeps, vCandidates, vX, vY);
+        for (int k = 0; k < (int)vCandidates.size(); k++)
+        {
+            int j = vCandidates[k];
+            //Une proie touchee est mangee, pas chassee
+            if (vWolves.theresOverlap(pWolf, vSheeps, j))
+                continue;
+            int vDistance = vBlock.distance_[k];
+            if (vBest == -1 || vDistance < vBestDistance || (vDistance == vBestDistance && j < vBest))
+            {
+                vBest = j;
+                vBestDistance = vDistance;
+            }
+        }
+    }
+    distance = vBestDistance;
+    return vBest;
 }
 /////////////////////////////////////////////
-void sheep::move()
+int ground::trackPrey(int i)
 {
-    if (!canMoveX() || !canMoveY())
-        this->setRandomVelocitys();
-    this->x_ += this->xVelocity_;
-    this->y_ += this->yVelocity_;
+    speciesTable& vSheeps = this->store_.sheeps_;
+    speciesTable& vWolves = this->next_.wolves_;
+    //La proie du tick precedent est gardee tant qu'elle vit, n'est pas touchee et reste
+    //a moins d'une cellule de grille plus loin que quand elle a ete choisie (une proie
+    //qui fuit a la meme vitesse ne relance pas la recherche a chaque tick) ; sinon, et
+    //tous les prey_refresh_ticks (decales par id_), on cherche a nouveau dans les
+    //anneaux de la grille autour du loup
+    int vPrey = vWolves.prey_[i] == no_prey ? -1 : vSheeps.findId(vWolves.prey_[i]);
+    bool vRefresh = (vWolves.tick_ + vWolves.id_[i]) % prey_refresh_ticks == 0;
+    if (vPrey != -1 && !vRefresh && !vWolves.theresOverlap(i, vSheeps, vPrey))
+    {
+        int vDistance = vWolves.getSquaredDistance(i, vSheeps, vPrey);
+        if (vDistance <= vWolves.preyBand_[i])
+            return vPrey;
+    }
+    int vDistance = 0;
+    vPrey = this->findNearestPrey(i, vDistance);
+    vWolves.prey_[i] = vPrey == -1 ? no_prey : vSheeps.id_[vPrey];
+    //Limite de la bande au carre, une seule racine par recherche
+    double vBand = std::sqrt((double)vDistance) + grid_cell_size;
+    vWolves.preyBand_[i] = (int)std::min(vBand * vBand, (double)std::numeric_limits<int>::max());
+    return vPrey;
 }
 /////////////////////////////////////////////
-void sheep::updateBoostTime()
+void ground::updateBoostTime(int i)
 {
-    this->cooldown_--;
-    this->boostTime_--;
-    if (this->cooldown_ <= 0 && !this->hasPropertie("canboost"))
-        this->addPropertie("canboost");
-    if (this->removePropertie("boost"))
+    //La fin du sprint et de la recuperation sont des echeances (fireTimers)
+    speciesTable& vSheeps = this->next_.sheeps_;
+    int& vXVelocity = vSheeps.xVelocity_[i];
+    int& vYVelocity = vSheeps.yVelocity_[i];
+    uint64_t vTick = vSheeps.tick_;
+    if (vSheeps.removePropertie(i, propertie::boost))
     {
-        this->addPropertie("boosted");
-        this->cooldown_ = 200;
-        this->boostTime_ = 15;
-        this->xVelocity_ += 2 * ((this->xVelocity_ > 0) - (this->xVelocity_ < 0));
-        this->yVelocity_ += 2 * ((this->yVelocity_ > 0) - (this->yVelocity_ < 0));
+        //Comme l'ancien decompte : recuperation echue, le sprint peut etre relance au tick suivant
+        if (vSheeps.cooldown_[i] <= vTick)
+            vSheeps.addPropertie(i, propertie::canboost);
+        vSheeps.cooldown_[i] = vTick + std::max(1, this->params_.boostCooldown);
+        this->scheduleTimer(vSheeps.cooldown_[i], vSheeps.id_[i], timerKind::boostReady);
+        if (this->params_.boostTime > 0)
+        {
+            vSheeps.addPropertie(i, propertie::boosted);
+            vSheeps.boostTime_[i] = vTick + this->params_.boostTime - 1;
+            this->scheduleTimer(vSheeps.boostTime_[i], vSheeps.id_[i], timerKind::boostEnd);
+            vXVelocity += this->params_.boostSpeed * ((vXVelocity > 0) - (vXVelocity < 0));
+            vYVelocity += this->params_.boostSpeed * ((vYVelocity > 0) - (vYVelocity < 0));
+        }
     }
-    if (this->boostTime_ <= 0 && this->removePropertie("boosted"))
+    //Sprint fini au tick precedent (fireTimers) : vitesse rendue apres la fuite et
+    //avant le deplacement. Ignore si le sprint vient d'etre relance
+    if (vSheeps.removePropertie(i, propertie::unboost) && vSheeps.boostTime_[i] < vTick && vSheeps.removePropertie(i, propertie::boosted))
     {
-        this->xVelocity_ -= 2 * ((this->xVelocity_ > 0) - (this->xVelocity_ < 0));
-        this->yVelocity_ -= 2 * ((this->yVelocity_ > 0) - (this->yVelocity_ < 0));
+        vXVelocity -= this->params_.boostSpeed * ((vXVelocity > 0) - (vXVelocity < 0));
+        vYVelocity -= this->params_.boostSpeed * ((vYVelocity > 0) - (vYVelocity < 0));
     }
 }
 /////////////////////////////////////////////
-void sheep::updateProcreateTime()
+void ground::updateProcreateTime(int i)
 {
-    this->procreateTime_--;
-    if (this->removePropertie("hasprocreate"))
-        this->procreateTime_ = 500;
-    else if (this->procreateTime_ <= 0 && !this->hasPropertie("canprocreate"))
-        this->addPropertie("canprocreate");
+    speciesTable& vSheeps = this->next_.sheeps_;
+    if (!vSheeps.removePropertie(i, propertie::hasprocreate))
+        return;
+    vSheeps.procreateTime_[i] = vSheeps.tick_ + std::max(1, this->params_.procreateTime);
+    this->scheduleTimer(vSheeps.procreateTime_[i], vSheeps.id_[i], timerKind::procreateReady);
 }
-//*****************************************************************************
-//*********************************** WOLF ************************************
-//*****************************************************************************
-int wolf::ImgW = 157;
-int wolf::ImgH = 110;
-wolf::wolf(SDL_Surface* window_surface_ptr, int x, int y) :
-    renderedObject("media/wolf.png", window_surface_ptr, wolf::ImgW, wolf::ImgH, x, y), animatedObject(5), movingObject(3)
+/////////////////////////////////////////////
+void ground::updateLifeTime(int i)
 {
-    this->preyDistance_ = -1;
-    this->lifeTime_ = 500;
-    this->properties_ = {"wolf"};
-    this->setSurfaceMap();
+    speciesTable& vWolves = this->next_.wolves_;
+    if (!vWolves.removePropertie(i, propertie::full))
+        return;
+    vWolves.lifeTime_[i] = vWolves.tick_ + this->params_.wolfLifeTime;
+    this->scheduleTimer(vWolves.lifeTime_[i], vWolves.id_[i], timerKind::starve);
 }
 /////////////////////////////////////////////
-wolf::wolf(SDL_Surface* window_surface_ptr) :
-    wolf::wolf(window_surface_ptr, (rand() % (frame_width - wolf::ImgW)), (rand() % (frame_height - wolf::ImgH)))
-{}
+void ground::scheduleTimer(uint64_t tick, uint32_t id, timerKind kind)
+{
+    this->newTimers_[threadPool::getWorker()].push_back({ tick, id, kind });
+}
 /////////////////////////////////////////////
-void wolf::choosePrey(renderedObject* pO2)
+void ground::fireTimers()
 {
-    int distance = this->getDistance(pO2);
-    if (this->preyDistance_ == -1 || this->preyDistance_ > distance)
+    PROFILE_PHASE("fireTimers");
+    //Listes des threads reunies et triees par id_ : la roue recoit le meme ordre
+    //quel que soit le decoupage de parallelFor
+    std::vector<timerEvent>& vNew = this->newTimers_[0];
+    for (size_t k = 1; k < this->newTimers_.size(); k++)
+    {
+        vNew.insert(vNew.end(), this->newTimers_[k].begin(), this->newTimers_[k].end());
+        this->newTimers_[k].clear();
+    }
+    std::sort(vNew.begin(), vNew.end(), [](const timerEvent& a, const timerEvent& b) {
+        return a.id_ != b.id_ ? a.id_ < b.id_ : a.kind_ < b.kind_;
+    });
+    for (const timerEvent& vEvent : vNew)
+        this->timers_.schedule(vEvent.tick_, vEvent.id_, vEvent.kind_);
+    vNew.clear();
+    //Apres les mises a jour : meme moment du tick que l'ancien decompte. Une
+    //echeance repoussee depuis (loup qui a mange) ne correspond plus a la colonne
+    speciesTable& vSheeps = this->next_.sheeps_;
+    speciesTable& vWolves = this->next_.wolves_;
+    uint64_t vTick = vSheeps.tick_;
+    this->timers_.advance(vSheeps.tick_, this->fired_);
+    for (const timerEvent& vEvent : this->fired_)
     {
-        this->preyDistance_ = distance;
-        this->goToward(pO2);
+        speciesTable& vTable = vEvent.kind_ == timerKind::starve ? vWolves : vSheeps;
+        int i = vTable.findId(vEvent.id_);
+        if (i == -1)
+            continue;//Retiree par removeDeads
+        switch (vEvent.kind_)
+        {
+        case timerKind::boostReady:
+            if (vSheeps.cooldown_[i] <= vTick)
+                vSheeps.addPropertie(i, propertie::canboost);
+            break;
+        case timerKind::boostEnd:
+            if (vSheeps.boostTime_[i] <= vTick && vSheeps.hasPropertie(i, propertie::boosted))
+                vSheeps.addPropertie(i, propertie::unboost);//Applique par updateBoostTime
+            break;
+        case timerKind::procreateReady:
+            if (vSheeps.procreateTime_[i] <= vTick)
+                vSheeps.addPropertie(i, propertie::canprocreate);
+            break;
+        case timerKind::starve:
+            if (vWolves.lifeTime_[i] <= vTick)
+                vWolves.addPropertie(i, propertie::dead);
+            break;
+        }
     }
 }
 /////////////////////////////////////////////
-std::map<std::string, std::vector<std::string>> wolf::getPathMap()
+void ground::scheduleTimers()
 {
-    std::string p = "media/wolfs/";
-    std::vector<std::string> vPNW = {};
-    std::vector<std::string> vPNE = {};
-    std::vector<std::string> vPSW = {};
-    std::vector<std::string> vPSE = {};
-    for (int i = 1; i <= 12; i++)
+    //Une echeance en attente pour chaque etat qui doit finir
+    speciesTable& vSheeps = this->store_.sheeps_;
+    speciesTable& vWolves = this->store_.wolves_;
+    this->timers_.reset(vSheeps.tick_);
+    for (int i = 0; i < vSheeps.size(); i++)
     {
-        vPNW.push_back(p + "nw (" + std::to_string(i) + ").png");
-        vPNE.push_back(p + "ne (" + std::to_string(i) + ").png");
-        vPSW.push_back(p + "sw (" + std::to_string(i) + ").png");
-        vPSE.push_back(p + "se (" + std::to_string(i) + ").png");
+        if (!vSheeps.hasPropertie(i, propertie::canboost))
+            this->timers_.schedule(vSheeps.cooldown_[i], vSheeps.id_[i], timerKind::boostReady);
+        if (vSheeps.hasPropertie(i, propertie::boosted) && !vSheeps.hasPropertie(i, propertie::unboost))
+            this->timers_.schedule(vSheeps.boostTime_[i], vSheeps.id_[i], timerKind::boostEnd);
+        if (!vSheeps.hasPropertie(i, propertie::canprocreate))
+            this->timers_.schedule(vSheeps.procreateTime_[i], vSheeps.id_[i], timerKind::procreateReady);
     }
-    std::map<std::string, std::vector<std::string>> pathMap = { {"nw",vPNW},{"ne",vPNE},{"sw",vPSW},{"se",vPSE} };
-    return pathMap;
+    for (int i = 0; i < vWolves.size(); i++)
+        this->timers_.schedule(vWolves.lifeTime_[i], vWolves.id_[i], timerKind::starve);
+}
+/////////////////////////////////////////////
+void ground::updateTarget(int i)
+{
+    speciesTable& vDogs = this->next_.dogs_;
+    if (vDogs.hasPropertie(i, propertie::go) && abs(vDogs.x_[i] - vDogs.xTarget_[i]) < 18 && abs(vDogs.y_[i] - vDogs.yTarget_[i]) < 18)
+        vDogs.removePropertie(i, propertie::go);
+    else if (vDogs.hasPropertie(i, propertie::go))
+        vDogs.goToward(i, vDogs.xTarget_[i], vDogs.yTarget_[i]);
 }
 /////////////////////////////////////////////
-std::string wolf::getImageKey()
+void ground::removeDeads()
 {
-    if (this->xVelocity_ <= 0 && this->yVelocity_ >= 0){return "sw";}
-    if (this->xVelocity_ >= 0 && this->yVelocity_ >= 0){return "se";}
-    if (this->xVelocity_ <= 0 && this->yVelocity_ <= 0){return "nw";}
-    return "ne";
+    PROFILE_PHASE("removeDeads");
+    //Un mouton ne meurt que mange, un loup que de faim
+    int vSheeps = this->store_.sheeps_.size();
+    int vWolves = this->store_.wolves_.size();
+    this->store_.removeDeads();
+    this->gridsValid_ = false;
+    this->stats_.kills_ += vSheeps - this->store_.sheeps_.size();
+    this->stats_.starvations_ += vWolves - this->store_.wolves_.size();
 }
 /////////////////////////////////////////////
-void wolf::update()
+void ground::addNews()
 {
-    this->removePropertie("scared");
-    this->preyDistance_ = -1;
-    this->updateLifeTime();
-    this->move();
-    this->updateFrameDuration();
-    this->draw();
+    PROFILE_PHASE("addNews");
+    speciesTable& vSheeps = this->store_.sheeps_;
+    int n = vSheeps.size();
+    for (int i = 0; i < n; i++)
+        if (vSheeps.removePropertie(i, propertie::pregnant))
+        {
+            this->addSheep(vSheeps.x_[i], vSheeps.y_[i]);
+            this->stats_.births_++;
+        }
 }
 /////////////////////////////////////////////
-void wolf::move()
+void ground::setKeys(uint8_t keys) { this->keys_ = keys; }
+/////////////////////////////////////////////
+void ground::click(int x, int y)
 {
-    if (!canMoveX() || !canMoveY())
-        this->setRandomVelocitys();
-    this->x_ += this->xVelocity_;
-    this->y_ += this->yVelocity_;
+    speciesTable& vDogs = this->store_.dogs_;
+    for (int i = 0; i < vDogs.size(); i++)
+    {
+        if (vDogs.hasInside(i, x, y))
+        {
+            vDogs.addPropertie(i, propertie::clicked);
+            vDogs.removePropertie(i, propertie::go);
+        }
+        else if (vDogs.removePropertie(i, propertie::clicked))
+        {
+            vDogs.addPropertie(i, propertie::go);
+            vDogs.xTarget_[i] = std::min(vDogs.worldWidth_ - vDogs.width_, x);
+            vDogs.yTarget_[i] = std::min(vDogs.worldHeight_ - vDogs.height_, y);
+        }
+    }
 }
 /////////////////////////////////////////////
-void wolf::updateLifeTime()
+bool ground::mouseEvents(std::vector<SDL_Point>& clicks)
 {
-    this->lifeTime_--;
-    if (this->removePropertie("full"))
-        this->lifeTime_ = 500;
-    else if (this->lifeTime_ <= 0)
-        this->addPropertie("dead");
+    PROFILE_PHASE("mouseEvents");
+    SDL_Event e;
+    while (SDL_PollEvent(&e))
+    {
+        switch (e.type)
+        {
+            case SDL_QUIT: return true;
+            case SDL_WINDOWEVENT:
+                //Le contenu de la fenetre a pu etre perdu
+                if (e.window.event == SDL_WINDOWEVENT_EXPOSED)
+                    this->fullRedraw_ = true;
+                break;
+            case SDL_MOUSEBUTTONDOWN:
+                //Appliques par application::applyClicks, qui peut les enregistrer
+                clicks.push_back({ e.button.x, e.button.y });
+                break;
+        }
+    }
+    return false;
 }
 //*****************************************************************************
-// ********************************** GROUND **********************************
+//******************************** APPLICATION ********************************
 //*****************************************************************************
-ground::ground(SDL_Surface* window_surface_ptr):
-    window_surface_ptr_{window_surface_ptr}
+application::application(unsigned n_sheep, unsigned n_wolf, bool headless, int n_threads, uint64_t seed, const simulationParams& params)
 {
-    this->image_ptr_ = load_surface_for("media/grass.png", window_surface_ptr);
-    this->shepherd_ = new shepherd(this->window_surface_ptr_);
-    this->movingObjects_ = {};
+    this->headless_ = headless;
+    this->window_ptr_ = NULL;
+    this->window_surface_ptr_ = NULL;
+    this->checkpointEvery_ = 0;
+    this->telemetryEvery_ = 0;
+    this->replay_ = false;
+    this->replayNext_ = 0;
+    this->keys_ = 0;
+    this->log_.seed_ = seed;
+    this->log_.sheep_ = n_sheep;
+    this->log_.wolves_ = n_wolf;
+    this->log_.worldWidth_ = params.worldWidth;
+    this->log_.worldHeight_ = params.worldHeight;
+    this->log_.lodPeriod_ = params.lodPeriod;
+    if (!this->headless_)
+    {
+        //window_ptr_
+        this->window_ptr_ = SDL_CreateWindow("SDL2 Window", SDL_WINDOWPOS_CENTERED,
+                            SDL_WINDOWPOS_CENTERED, frame_width, frame_height, 0);
+        if (!this->window_ptr_)
+            throw std::runtime_error(std::string(SDL_GetError()));
+        //window_surface_ptr_
+        this->window_surface_ptr_ = SDL_GetWindowSurface(this->window_ptr_);
+        SDL_BlitSurface( this->window_surface_ptr_, NULL, this->window_surface_ptr_, NULL);
+        if (!this->window_surface_ptr_)
+            throw std::runtime_error(std::string(SDL_GetError()));
+        SDL_UpdateWindowSurface(this->window_ptr_);
+    }
+    //ground_ (window_surface_ptr_ NULL en headless : aucun chargement d'image)
+    this->g_ = new ground(this->window_surface_ptr_, n_threads, seed, params);
+    for (unsigned i = 0; i < n_sheep; i++)
+        this->g_->addSheep();
+    for (unsigned i = 0; i < n_wolf; i++)
+        this->g_->addWolf();
+    this->g_->addShepherd();
+    for (int i = 0; i < 1; i++)
+        this->g_->addDog();
 }
 /////////////////////////////////////////////
-void ground::addMovingObject(movingObject* pO)
+void application::setCheckpoints(unsigned every, const std::string& prefix)
 {
-    this->movingObjects_.push_back(pO);
+    this->checkpointEvery_ = every;
+    this->checkpointPrefix_ = prefix;
 }
 /////////////////////////////////////////////
-int ground::getScore()
+void application::restore(const std::string& path)
 {
-    int vScore = 0;
-    for (movingObject* vMO : this->movingObjects_)
-        if (vMO->hasPropertie("sheep"))
-            vScore++;
-    return vScore;
+    this->g_->loadCheckpoint(path);
+    printf("Restored %s at tick %llu\n", path.c_str(), (unsigned long long)this->g_->getTick());
 }
 /////////////////////////////////////////////
-bool ground::update()
+void application::setTelemetry(const std::string& path, unsigned every)
 {
-    if (this->mouseEvents())
-        return true;
-    this->drawGround();
-    this->updateObjects();
-    this->removeDeads();
-    this->addNews();
-    return false;
+    this->telemetry_.reset(new telemetryWriter(path));
+    this->telemetryEvery_ = std::max(1u, every);
 }
 /////////////////////////////////////////////
-void ground::drawGround()
+void application::setRecord(const std::string& path, const std::string& restore)
 {
-    for (int y = 0; y < frame_height; y += 61)
-    {
-        for (int x = 0; x < frame_width; x += 108)
-        {
-            SDL_Rect vRect = { x, y, 0 , 0 };
-            SDL_BlitSurface(this->image_ptr_, NULL, this->window_surface_ptr_, &vRect);
-        }
-    }
+    this->recordPath_ = path;
+    this->log_.restore_ = restore;
 }
 /////////////////////////////////////////////
-void ground::updateObjects()
+void application::setReplay(const inputLog& log)
 {
-    for (movingObject* vMovingObject : this->movingObjects_)
-    {
-        for (movingObject* vMovingObject2 : this->movingObjects_)
-            if (vMovingObject2 != vMovingObject)
-                vMovingObject->interact(vMovingObject2);
-        vMovingObject->update();
-    }
+    this->log_ = log;
+    this->replay_ = true;
+    this->replayNext_ = 0;
+    if (!log.restore_.empty())
+        this->restore(log.restore_);
+    //Les entrees d'avant le tick de depart (celui de l'instantane) ne seraient jamais rejouees
+    if (!log.events_.empty() && log.events_.front().tick_ < this->g_->getTick())
+        throw std::runtime_error("Input log starts at tick " + std::to_string(this->g_->getTick()) + " but has an entry at tick "
+                                 + std::to_string(log.events_.front().tick_) + "\n");
 }
 /////////////////////////////////////////////
-void ground::removeDeads()
+void application::applyClicks(const std::vector<SDL_Point>& clicks)
 {
-    std::vector<movingObject*>::iterator it = this->movingObjects_.begin();
-    while (it != this->movingObjects_.end())
+    //En rejeu seuls les clics enregistres comptent
+    if (this->replay_)
+        return;
+    for (const SDL_Point& vClick : clicks)
     {
-        if ((*it)->hasPropertie("dead"))
-            it = this->movingObjects_.erase(it);
-        else
-            it++;
+        //Enregistre dans le monde : le rejeu ne depend pas de la camera
+        SDL_Point vWorld = this->g_->toWorld(vClick);
+        this->g_->click(vWorld.x, vWorld.y);
+        if (!this->recordPath_.empty())
+            this->log_.events_.push_back({ this->g_->getTick(), 'C', vWorld.x, vWorld.y });
     }
 }
 /////////////////////////////////////////////
-void ground::addNews()
+void application::moveCamera()
+{
+    //ZQSD / WASD selon le clavier (scancodes) deplacent la camera, espace la recentre sur le berger
+    const uint8_t* keystate = SDL_GetKeyboardState(0);
+    int dx = (keystate[SDL_SCANCODE_D] ? camera_speed : 0) - (keystate[SDL_SCANCODE_A] ? camera_speed : 0);
+    int dy = (keystate[SDL_SCANCODE_S] ? camera_speed : 0) - (keystate[SDL_SCANCODE_W] ? camera_speed : 0);
+    if (dx != 0 || dy != 0)
+        this->g_->panCamera(dx, dy);
+    if (keystate[SDL_SCANCODE_SPACE])
+        this->g_->followShepherd();
+}
+/////////////////////////////////////////////
+void application::step()
 {
-    int n = this->movingObjects_.size();
-    for (int i = 0; i < n - 1; i++)
+    uint64_t vTick = this->g_->getTick();
+    if (this->replay_)
+    {
+        //Les entrees datees de ce tick, dans l'ordre ou elles ont ete faites
+        while (this->replayNext_ < this->log_.events_.size() && this->log_.events_[this->replayNext_].tick_ == vTick)
+        {
+            const inputEvent& vEvent = this->log_.events_[this->replayNext_++];
+            if (vEvent.type_ == 'K')
+                this->keys_ = (uint8_t)vEvent.a_;
+            else
+                this->g_->click(vEvent.a_, vEvent.b_);
+        }
+    }
+    else
     {
-        movingObject* vMO = this->movingObjects_[i];
-        if (vMO->removePropertie("pregnant"))
-            this->addMovingObject(new sheep(this->window_surface_ptr_, vMO->getX(), vMO->getY()));
+        const uint8_t* keystate = SDL_GetKeyboardState(0);
+        uint8_t vKeys = (keystate[SDL_SCANCODE_LEFT] ? key_left : 0) | (keystate[SDL_SCANCODE_RIGHT] ? key_right : 0)
+                      | (keystate[SDL_SCANCODE_UP] ? key_up : 0) | (keystate[SDL_SCANCODE_DOWN] ? key_down : 0);
+        //On n'enregistre que les changements
+        if (vKeys != this->keys_ && !this->recordPath_.empty())
+            this->log_.events_.push_back({ vTick, 'K', vKeys, 0 });
+        this->keys_ = vKeys;
     }
+    this->g_->setKeys(this->keys_);
+    this->g_->step();
+    if (this->telemetry_ && this->g_->getTick() % this->telemetryEvery_ == 0)
+        this->telemetry_->push(this->g_->getStats());
+    if (this->checkpointEvery_ == 0 || this->g_->getTick() % this->checkpointEvery_ != 0)
+        return;
+    std::string vPath = this->checkpointPrefix_ + "_" + std::to_string(this->g_->getTick()) + ".ckpt";
+    if (!this->g_->saveCheckpoint(vPath))
+        printf("Checkpoint %s skipped, writer busy\n", vPath.c_str());
 }
 /////////////////////////////////////////////
-bool ground::mouseEvents()
+int application::replay()
 {
-    SDL_Event e;
-    while (SDL_PollEvent(&e))
+    printf("Replaying %zu inputs up to tick %llu\n", this->log_.events_.size(), (unsigned long long)this->log_.endTick_);
+    const Uint64 vStart = SDL_GetPerformanceCounter();
+    std::vector<SDL_Point> vClicks;
+    while (this->g_->getTick() < this->log_.endTick_)
     {
-        switch (e.type)
+        PROFILE_PHASE("frame");
+        this->step();
+        if (this->headless_)
+            continue;
+        //Une image par tick, sans attente ; seul quit est ecoute
+        vClicks.clear();
+        if (this->g_->mouseEvents(vClicks))
         {
-            case SDL_QUIT: return true;
-            case SDL_MOUSEBUTTONDOWN:
-                for (movingObject* vMovingObject : this->movingObjects_) 
-                {
-                    if (vMovingObject->hasPropertie("dog") && vMovingObject->hasInside(e.motion.x, e.motion.y))
-                    {
-                        vMovingObject->addPropertie("clicked");
-                        vMovingObject->removePropertie("go");
-                    }
-                    else if (vMovingObject->hasPropertie("dog") && vMovingObject->removePropertie("clicked"))
-                    {
-                        vMovingObject->addPropertie("go");
-                        dog* vD = (dog*)vMovingObject;
-                        vD->setXTarget(e.motion.x);
-                        vD->setYTarget(e.motion.y);
-                    }
-                }
+            this->close();
+            return 1;
         }
+        this->moveCamera();
+        this->g_->render();
+        this->g_->present(this->window_ptr_);
+    }
+    double vSeconds = (SDL_GetPerformanceCounter() - vStart) / (double)SDL_GetPerformanceFrequency();
+    printf("\nTicks : %llu in %.2fs (%.1f ticks/s)\n", (unsigned long long)this->g_->getTick(), vSeconds, this->g_->getTick() / std::max(vSeconds, 1e-9));
+    printf("\nScore : %d\n", this->g_->getScore());
+    uint64_t vHash = this->g_->getStore().getHash();
+    this->close();
+    if (vHash != this->log_.endHash_)
+    {
+        printf("Replay MISMATCH : final state %016llx, recorded %016llx\n", (unsigned long long)vHash, (unsigned long long)this->log_.endHash_);
+        return 2;
     }
+    printf("Replay OK : final state matches the recording at tick %llu\n", (unsigned long long)this->log_.endTick_);
+    return 0;
 }
-//*****************************************************************************
-//******************************** APPLICATION ********************************
-//*****************************************************************************
-application::application(unsigned n_sheep, unsigned n_wolf)
+/////////////////////////////////////////////
+void application::close()
 {
-    //window_ptr_
-    this->window_ptr_ = SDL_CreateWindow("SDL2 Window", SDL_WINDOWPOS_CENTERED,
-                        SDL_WINDOWPOS_CENTERED, frame_width, frame_height, 0);
-    if (!this->window_ptr_)
-        throw std::runtime_error(std::string(SDL_GetError()));
-    //window_surface_ptr_
-    this->window_surface_ptr_ = SDL_GetWindowSurface(this->window_ptr_);
-    SDL_BlitSurface( this->window_surface_ptr_, NULL, this->window_surface_ptr_, NULL);
-    if (!this->window_surface_ptr_)
-        throw std::runtime_error(std::string(SDL_GetError()));
-    SDL_UpdateWindowSurface(this->window_ptr_);
-    //ground_
-    this->g_ = new ground(this->window_surface_ptr_);
-    for (int i = 0; i < n_sheep; i++)
-        this->g_->addMovingObject(new sheep(this->window_surface_ptr_));
-    for (int i = 0; i < n_wolf; i++)
-        this->g_->addMovingObject(new wolf(this->window_surface_ptr_));
-    this->g_->addMovingObject(new shepherd(this->window_surface_ptr_));
-    for (int i = 0; i < 1; i++)
-        this->g_->addMovingObject(new dog(this->window_surface_ptr_));
+    this->g_->waitCheckpoints();
+    if (this->recordPath_.empty())
+        return;
+    this->log_.endTick_ = this->g_->getTick();
+    this->log_.endHash_ = this->g_->getStore().getHash();
+    this->log_.save(this->recordPath_);
+    printf("Recorded %zu inputs up to tick %llu in %s\n", this->log_.events_.size(), (unsigned long long)this->log_.endTick_, this->recordPath_.c_str());
 }
 /////////////////////////////////////////////
 int application::loop(unsigned period)
 {
-    auto start = SDL_GetTicks();
-    while ((SDL_GetTicks() - start < period*1000)) 
+    if (this->replay_)
+        return this->replay();
+    //Pas de simulation fixe (frame_time) decouple de l'affichage :
+    //l'accumulateur recoit le temps ecoule et est consomme par pas entiers
+    const Uint64 vFrequency = SDL_GetPerformanceFrequency();
+    const Uint64 vStep = (Uint64)(vFrequency * frame_time);
+    const Uint64 vEnd = SDL_GetPerformanceCounter() + (Uint64)period * vFrequency;
+    Uint64 vPrevious = SDL_GetPerformanceCounter();
+    Uint64 vAccumulator = vStep;//Premier pas immediat
+    unsigned long vSteps = 0;
+    unsigned long vFrames = 0;
+    unsigned long vLateFrames = 0;//Image qui a du rattraper plus d'un pas
+    unsigned long vDroppedSteps = 0;//Pas abandonnes au-dela de max_steps_per_frame
+    std::vector<SDL_Point> vClicks;
+    while (vPrevious < vEnd) 
     {
-        if (this->g_->update())
+        PROFILE_PHASE("frame");
+        Uint64 vNow = SDL_GetPerformanceCounter();
+        //Headless : pas de presentation ni de limite a 60 Hz
+        if (this->headless_)
+        {
+            this->step();
+            vSteps++;
+            vPrevious = vNow;
+            continue;
+        }
+        vAccumulator += vNow - vPrevious;
+        vPrevious = vNow;
+        vClicks.clear();
+        if (this->g_->mouseEvents(vClicks))
+        {
+            this->close();
             return 1;
-        SDL_UpdateWindowSurface(this->window_ptr_);
-        SDL_Delay(700*frame_time);
+        }
+        this->applyClicks(vClicks);
+        int vFrameSteps = 0;
+        while (vAccumulator >= vStep && vFrameSteps < max_steps_per_frame)
+        {
+            this->step();
+            vAccumulator -= vStep;
+            vFrameSteps++;
+        }
+        //Trop en retard : on abandonne les pas restants plutot que de s'enliser
+        if (vAccumulator >= vStep)
+        {
+            vDroppedSteps += vAccumulator / vStep;
+            vAccumulator %= vStep;
+        }
+        vSteps += vFrameSteps;
+        if (vFrameSteps > 0)
+        {
+            this->moveCamera();
+            this->g_->render();
+            PROFILE_PHASE("present");
+            this->g_->present(this->window_ptr_);
+            vFrames++;
+            if (vFrameSteps > 1)
+                vLateFrames++;
+        }
+        //Dort jusqu'au prochain pas, la derniere milliseconde se fait en attente active
+        Uint64 vWait = (vStep - vAccumulator) * 1000 / vFrequency;
+        if (vWait > 1)
+            SDL_Delay((Uint32)(vWait - 1));
     }
+    if (this->headless_)
+        printf("\nTicks : %lu (%.1f ticks/s)\n", vSteps, vSteps / (double)std::max(1u, period));
+    else
+        printf("\nSteps : %lu, frames : %lu, late frames : %lu, dropped steps : %lu\n", vSteps, vFrames, vLateFrames, vDroppedSteps);
     printf("\nScore : %d\n", this->g_->getScore());
+    populationStats vStats = this->g_->getStats();
+    printf("Wolves : %u, births : %llu, kills : %llu, starvations : %llu\n", vStats.wolves_,
+           (unsigned long long)vStats.births_, (unsigned long long)vStats.kills_, (unsigned long long)vStats.starvations_);
+    if (this->telemetry_ && this->telemetry_->getDropped() > 0)
+        printf("Telemetry : %llu records dropped, writer too slow\n", (unsigned long long)this->telemetry_->getDropped());
+    this->close();
     return 0;
-}
\ No newline at end of file
+}
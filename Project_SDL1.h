@@ -3,199 +3,795 @@
 #pragma once
 #include "SDL2/include/SDL.h"
 #include "SDL2/include/SDL_image.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <iostream>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
 #include <vector>
 #include <map>
 
 // Defintions
 constexpr double frame_rate = 60.0; // refresh rate
 constexpr double frame_time = 1. / frame_rate;
+constexpr int max_steps_per_frame = 5; // Catch-up limit, older steps are dropped
+constexpr int random_position = -1; // Spawn anywhere in the window (see ground::spawn)
 constexpr unsigned frame_width = 800; // Width of window in pixel
 constexpr unsigned frame_height = 700; // Height of window in pixel
+constexpr int world_max_size = 32768; // Keeps squared distances within 32 bits (distanceKernel)
+constexpr int camera_speed = 12; // Pixels per frame when panning with WASD
+constexpr int grass_width = 108; // Background tile (media/grass.png)
+constexpr int grass_height = 61;
 
-// Helper function to initialize SDL
-void init();
+// Interaction distances (see ground::updateSheep/updateWolf/updateDogs)
+constexpr int dog_scare_distance = 150; // wolf runs away from a dog closer than this
+constexpr int wolf_flee_distance = 200; // sheep runs away from a wolf closer than this
+constexpr int dog_follow_distance = 100; // dog goes back to the shepherd farther than this
+constexpr int prey_refresh_ticks = 8; // A wolf searches for a closer prey at least this often
+constexpr uint32_t no_prey = 0xFFFFFFFF; // speciesTable::prey_ of a wolf without target
+
+// Behaviour constants of one simulation, the defaults are the game's (swept by batch.cpp)
+struct simulationParams
+{
+    int sheepVelocity = 3;
+    int wolfVelocity = 3;
+    int dogVelocity = 3;
+    int shepherdVelocity = 4;
+    int wolfLifeTime = 500; // ticks a wolf survives without eating
+    int boostCooldown = 200; // ticks between two sprints of a sheep
+    int boostTime = 15; // ticks a sprint lasts
+    int boostSpeed = 2; // added to each axis while sprinting
+    int procreateTime = 500; // ticks between two litters
+    int dogScareDistance = dog_scare_distance;
+    int wolfFleeDistance = wolf_flee_distance;
+    int dogFollowDistance = dog_follow_distance;
+    int worldWidth = frame_width; // The window is a camera over the world
+    int worldHeight = frame_height;
+    int lodPeriod = 4; // Ticks between two updates of a dormant chunk, 1 : full fidelity everywhere
+
+    void validate() const; // Throws if the spatial grid could miss a neighbour
+};
+
+// Spatial grid
+constexpr int grid_cell_size = 64; // Side of a grid cell in pixel
+constexpr int grid_max_box = 100; // Upper bound of any hitbox side (wolf : 78x88)
+constexpr int grid_slack = 16; // Max displacement of an object during one tick
+
+// Properties of an entity, one bit each in speciesTable::properties_
+enum class propertie : uint32_t
+{
+    sheep, prey, male, female, wolf, dog, shepherd,
+    scared, full, dead,
+    canboost, boost, boosted, unboost,
+    canprocreate, hasprocreate, pregnant,
+    go, clicked,
+    count
+};
+static_assert(static_cast<uint32_t>(propertie::count) <= 32, "speciesTable::properties_ holds 32 properties");
+constexpr uint32_t propertieBit(propertie pPropertie) { return 1u << static_cast<uint32_t>(pPropertie); }
+
+// Counter-based random generator : the result only depends on its key,
+// so entities updated in any order or on any thread draw the same numbers
+uint32_t counterRandom(uint64_t seed, uint64_t id, uint64_t tick, uint64_t counter);
+
+// Helper function to initialize SDL (headless : no video, no PNG loading)
+void init(bool headless = false);
 //*****************************************************************************
-// ********************************** OBJECT **********************************
+// ******************************* SPRITE ATLAS *******************************
 //*****************************************************************************
-class object
+// Cache commun a tout le processus : chaque image n'est chargee qu'une fois
+// et les surfaces sont partagees en lecture seule par tous les objets
+
+// Direction d'un sprite anime, d'apres le signe de la vitesse
+enum class direction : uint32_t
 {
-protected:
-    std::vector<std::string> properties_;
+    nw, ne, sw, se,
+    count
+};
+direction getDirection(int xVelocity, int yVelocity);
+
+// Images d'une espece animee, rangees par direction puis dans l'ordre de la
+// sequence : aucune chaine ni map a parcourir pour changer d'image
+struct animationTable
+{
+    std::vector<SDL_Surface*> frames_;//frames_[direction * frameCount_ + image]
+    int frameCount_;//Images par direction
+    int frameInterval_;//Images affichees avant de passer a la suivante
+};
+
+class spriteAtlas
+{
+private:
+    static std::map<std::string, SDL_Surface*> surfaces_;
+    static std::map<std::string, animationTable> animations_;
+
+public:
+    static SDL_Surface* getSurface(const std::string& path, SDL_Surface* window_surface_ptr);
+    //Chemins par direction, meme nombre d'images pour chacune. Construite une seule fois par nom
+    static const animationTable* addAnimations(const std::string& name, const std::vector<std::vector<std::string>>& paths, int frameInterval, SDL_Surface* window_surface_ptr);
+    static void release();//Libere toutes les surfaces
+};
+
+//*****************************************************************************
+// ******************************** THREAD POOL *******************************
+//*****************************************************************************
+// Le thread appelant participe : avec 1 thread aucun worker n'est cree
+class threadPool
+{
+private:
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable start_;
+    std::condition_variable done_;
+    std::function<void(int, int)> job_;
+    int jobSize_;
+    int chunkSize_;
+    std::atomic<int> nextChunk_;
+    int pending_;//Workers pas encore termines
+    unsigned generation_;//Incremente a chaque parallelFor
+    bool stop_;
+
+    static thread_local int worker_;//Index du thread qui execute le morceau en cours
+
+    void work(int worker);
+    void runChunks(int worker);
+
 public:
-    object();
+    threadPool(int nThreads);//0 : un thread par coeur
+    ~threadPool();
 
-    bool hasPropertie(std::string pPropertie);
-    bool removePropertie(std::string pPropertie);//True if removed
-    void addPropertie(std::string pPropertie);
+    int getThreadCount();
+    static int getWorker();//Dans un job de parallelFor : 0 pour l'appelant, puis 1 a getThreadCount() - 1
+    void parallelFor(int n, const std::function<void(int begin, int end)>& job, int minChunk = 64);//Bloquant
 };
 
 //*****************************************************************************
-// ***************************** RENDERED OBJECT ******************************
+// ********************************** PROFILER ********************************
 //*****************************************************************************
-class renderedObject:public object
+// Chronometres par phase, compiles seulement avec WOLFSHEEP_PROFILE
+// (cmake -DWOLFSHEEP_PROFILE=ON) : sinon PROFILE_PHASE ne genere aucun code.
+// Les phases sont mesurees depuis le thread principal uniquement, sans verrou :
+// CMake ne le definit que pour SDL_part1 et SDL_part1_headless (pas batch)
+#ifdef WOLFSHEEP_PROFILE
+constexpr int profile_buckets = 2048; // Log-linear histogram, 32 buckets per power of two (< 3% error)
+constexpr size_t profile_max_events = 1 << 20; // Trace events kept in memory, later ones are dropped
+
+class profiler
 {
-protected:
-    static int ImgW;
-    static int ImgH;
-    SDL_Surface* window_surface_ptr_;
-    SDL_Surface* image_ptr_;
+private:
+    struct phase
+    {
+        std::string name_;
+        std::vector<uint32_t> histogram_;//Nombre de mesures par bucket de duree (ns)
+        uint64_t count_;
+        uint64_t max_;
+    };
+    struct traceEvent
+    {
+        int phase_;
+        uint64_t start_;//ns depuis origin_
+        uint64_t duration_;
+    };
+    static std::vector<phase> phases_;
+    static std::vector<traceEvent> events_;
+    static std::string traceFile_;//Vide : pas de trace
+    static std::chrono::steady_clock::time_point origin_;
+
+    static int getBucket(uint64_t ns);
+    static uint64_t getBucketValue(int bucket);
+    static uint64_t getPercentile(const phase& pPhase, double percentile);
+
+public:
+    static int getPhase(const std::string& name);//Enregistre la phase au premier appel
+    static void record(int pPhase, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end);
+    static void setTraceFile(const std::string& path);
+    static void report();//Affiche p50/p99/max par phase et ecrit la trace
+};
+
+// Mesure la duree de vie du scope
+class phaseTimer
+{
+private:
+    int phase_;
+    std::chrono::steady_clock::time_point start_;
+
+public:
+    phaseTimer(int pPhase) : phase_{pPhase}, start_{std::chrono::steady_clock::now()} {}
+    ~phaseTimer() { profiler::record(this->phase_, this->start_, std::chrono::steady_clock::now()); }
+};
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+#define PROFILE_PHASE(name) \
+    static const int PROFILE_CONCAT(vPhase, __LINE__) = profiler::getPhase(name); \
+    phaseTimer PROFILE_CONCAT(vTimer, __LINE__)(PROFILE_CONCAT(vPhase, __LINE__))
+#else
+#define PROFILE_PHASE(name) ((void)0)
+#endif
+
+//*****************************************************************************
+// ******************************** OBJECT POOL *******************************
+//*****************************************************************************
+// Memoire des vues d'une espece : des blocs de pool_slab_size places, jamais
+// rendus au tas, et une liste des places libres. Une naissance reprend la place
+// d'un mort, sans malloc ni fragmentation au fil des cycles de population.
+// Utilise par les operator new / delete de chaque vue (thread principal seulement)
+constexpr int pool_slab_size = 256; // Objects per slab
+
+template <class T>
+class objectPool
+{
+private:
+    typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type slot;
+    std::vector<std::unique_ptr<slot[]>> slabs_;
+    std::vector<void*> free_;//Places libres, la derniere liberee est reprise en premier
+
+public:
+    void* allocate()
+    {
+        if (this->free_.empty())
+        {
+            this->slabs_.emplace_back(new slot[pool_slab_size]);
+            slot* vSlab = this->slabs_.back().get();
+            for (int i = pool_slab_size - 1; i >= 0; i--)
+                this->free_.push_back(&vSlab[i]);
+        }
+        void* vPlace = this->free_.back();
+        this->free_.pop_back();
+        return vPlace;
+    }
+    void deallocate(void* place) { this->free_.push_back(place); }
+    int getCapacity() { return (int)this->slabs_.size() * pool_slab_size; }
+    int getFree() { return (int)this->free_.size(); }
+};
+
+//*****************************************************************************
+// ******************************* SPECIES TABLE ******************************
+//*****************************************************************************
+class renderedObject;
+// Toutes les entites d'une espece, un tableau contigu par composant
+// (structure of arrays) : l'entite i est a l'index i de chaque tableau
+class speciesTable
+{
+public:
+    //Commun a l'espece
     int width_;//de l'image
     int height_;//de l'image
-    int x_;//de l'image
-    int y_;//de l'image
+    int totalVelocity_;
+    int worldWidth_;//Bornes de canMoveX / canMoveY (entityStore::setWorld)
+    int worldHeight_;
+    uint64_t seed_;//Cle du generateur avec id_ et tick_
+    uint64_t tick_;
+    //Un element par entite
+    std::vector<uint32_t> id_;//Unique et stable
+    std::vector<int> x_;//de l'image
+    std::vector<int> y_;//de l'image
+    std::vector<int> xVelocity_;
+    std::vector<int> yVelocity_;
+    std::vector<uint32_t> properties_;//Un bit par propertie
+    //Echeances en ticks absolus (64 bits comme tick_), une entree de timerWheel les fait tomber
+    std::vector<uint64_t> cooldown_;//sheep : fin de la recuperation du sprint
+    std::vector<uint64_t> boostTime_;//sheep : dernier tick du sprint
+    std::vector<uint64_t> procreateTime_;//sheep : accouplement de nouveau possible
+    std::vector<uint64_t> lifeTime_;//wolf : mort de faim
+    std::vector<int> xTarget_;//dog
+    std::vector<int> yTarget_;//dog
+    std::vector<uint32_t> prey_;//wolf : id_ de la proie chassee, no_prey sinon
+    std::vector<int> preyBand_;//wolf : (distance au choix de la proie + grid_cell_size) au carre
+    std::vector<uint32_t> draws_;//Nombres tires par l'entite pendant ce tick
+    std::vector<renderedObject*> views_;//Sprite de l'entite, NULL en headless et pour sheep et wolf (ground::animate)
+    //Rendu seulement : ni dans les instantanes ni dans getHash
+    std::vector<int> frame_;//Image affichee dans animationTable::frames_
+    std::vector<int> frameWait_;//Images avant la suivante, 0 : a la prochaine
 
-public:
-    renderedObject(const std::string& file_path, SDL_Surface* window_surface_ptr, int width, int height, int x, int y);
-    renderedObject() = default;
+    speciesTable(int width, int height, int totalVelocity);
+    void copyEntity(int from, int to);
+
+    int size();
+    int add(uint32_t id, int x, int y, uint32_t properties, renderedObject* view);//Index de la nouvelle entite
+    void removeDeads();//Compacte les tableaux en gardant l'ordre
+    int findId(uint32_t id);//Index de l'entite, -1 si morte ; id_ est croissant
+
+    bool hasPropertie(int i, propertie pPropertie);
+    bool removePropertie(int i, propertie pPropertie);//True if removed
+    void addPropertie(int i, propertie pPropertie);
 
-    int getX();
-    int getY();
-    void draw();
-    
-    bool theresOverlap(renderedObject* pO2);
-    bool hasInside(int x, int y);
-    int getDistance(renderedObject* pO2);
     int getWidthBox();
     int getHeightBox();
-    int getXBox();
-    int getYBox();
+    int getXBox(int i);
+    int getYBox(int i);
+    bool hasInside(int i, int x, int y);
+    int getDistance(int i, speciesTable& pTable2, int j);
+    int getSquaredDistance(int i, speciesTable& pTable2, int j);//Comme distanceKernel
+    bool theresOverlap(int i, speciesTable& pTable2, int j);
+
+    uint32_t random(int i);//counterRandom(seed_, id_[i], tick_, draws_[i]++)
+    bool canMoveX(int i);
+    bool canMoveY(int i);
+    void setRandomVelocitys(int i);
+    void adjustVelocitys(int i);
+    void goToward(int i, int x, int y);
+    void runAway(int i, int x, int y);
+    void move(int i);
 };
 
 //*****************************************************************************
-// ****************************** MOVING OBJECT *******************************
+// ******************************* ENTITY STORE *******************************
 //*****************************************************************************
-class movingObject : public virtual renderedObject
+// Etat de la simulation, groupe par espece. Copiable : ground garde l'etat
+// du tick precedent et celui du tick en cours
+class entityStore
 {
-protected:
-    int totalVelocity_;
-    int xVelocity_;
-    int yVelocity_;
 public:
-    movingObject(int totalVelocity);
+    speciesTable sheeps_;
+    speciesTable wolves_;
+    speciesTable dogs_;
+    speciesTable shepherds_;
+    uint32_t nextId_;
 
-    void setRandomVelocitys();
-    bool canMoveX();
-    bool canMoveY();
-    void adjustVelocitys();
-    void interact(renderedObject* pO2);
-    void runAway(renderedObject* pO2);
-    void runAway(int x, int y);
-    void goToward(renderedObject* pO2);
-    void goToward(int x, int y);
+    entityStore();
 
-    virtual void update() = 0;
-    virtual void move() = 0;
+    void setSeed(uint64_t seed);
+    void setWorld(int width, int height);
+    void nextTick();//Avance tick_ et remet draws_ a zero
+    void removeDeads();
+    void deleteViews();
+    uint64_t getHash();//Toutes les colonnes, pour comparer deux parties
 };
+
 //*****************************************************************************
-// ***************************** ANIMATED OBJECT ******************************
+// ******************************* SPRITE BATCH *******************************
 //*****************************************************************************
-class animatedObject : public virtual renderedObject
+// Noyau de copie des sprites 32 bits a cle de couleur (voir spriteBatch::draw)
+enum class blitKernel { sdl, scalar, sse2, avx2 };
+constexpr int render_tile_size = 128; // Side of a screen tile composited by one thread
+constexpr int render_parallel_min = 256; // Smaller batches are drawn by the calling thread
+
+// Un sprite a coller, ou un rectangle plein si image_ est NULL
+struct spriteDraw
+{
+    SDL_Surface* image_;
+    SDL_Rect rect_;//Position et taille dans la fenetre, avant decoupage
+    Uint32 color_;//Rectangle plein
+    int depth_;//Bas du sprite : les plus bas sont dessines par dessus
+};
+
+// Tous les sprites d'une image, tries par profondeur (ordre d'ajout a egalite).
+// Les sprites au format de la cible passent par un noyau SSE2/AVX2 (ou scalaire),
+// les autres par SDL_BlitSurface. L'ecran est decoupe en tuiles composees en
+// parallele, chacune ne touchant que ses pixels. En mode verification chaque
+// image est aussi dessinee par SDL, par tous les noyaux et en serie, et doit
+// etre identique au pixel pres
+class spriteBatch
+{
+private:
+    std::vector<spriteDraw> sprites_;
+    std::vector<std::vector<int>> tiles_;//Index des sprites touchant chaque tuile, dans l'ordre de dessin
+    int xOrigin_ = 0;//Coin de la cible dans le monde
+    int yOrigin_ = 0;
+    static blitKernel kernel_;
+    static bool check_;
+    static unsigned long checkedFrames_;
+
+    static bool isKernelPath(const spriteDraw& pSprite, SDL_Surface* target, blitKernel kernel);
+    static void drawSprite(const spriteDraw& pSprite, SDL_Surface* target, const SDL_Rect& clip, blitKernel kernel);
+    void drawAll(SDL_Surface* target, const SDL_Rect& clip, blitKernel kernel);
+    void drawTiles(SDL_Surface* target, const SDL_Rect& clip, blitKernel kernel, threadPool& pool);
+    void checkKernels(SDL_Surface* target, const SDL_Rect& clip, threadPool& pool);
+
+public:
+    void clear();
+    void setOrigin(int x, int y);//addSprite et addFill recoivent ensuite des positions du monde
+    void addSprite(SDL_Surface* image, int x, int y);
+    void addFill(const SDL_Rect& rect, Uint32 color, int depth);
+    void draw(SDL_Surface* target, threadPool& pool);//Dans target->clip_rect
+    const std::vector<spriteDraw>& getSprites();
+
+    static bool isSupported(blitKernel kernel);//Selon le processeur
+    static blitKernel getBestKernel();
+    static void setKernel(blitKernel kernel);
+    static void setCheck(bool check);
+    static unsigned long getCheckedFrames();
+    static blitKernel parseKernel(const std::string& name);
+};
+
+//*****************************************************************************
+// ***************************** DISTANCE KERNEL ******************************
+//*****************************************************************************
+// Distances au carre d'une hitbox (x, y) a un bloc de hitbox candidates
+// (xs[k], ys[k]) de taille width x height : la formule de
+// speciesTable::getDistance sans la racine, un seuil T se compare a T*T.
+// Noyau SSE2/AVX2 selon le processeur ; en mode verification chaque bloc est
+// aussi calcule par le noyau scalaire de reference et doit etre identique
+class distanceKernel
+{
+private:
+    static blitKernel kernel_;//sdl n'a pas de sens ici : scalaire
+    static bool check_;
+    static std::atomic<unsigned long> checkedBlocks_;
+
+public:
+    static void squaredDistances(int x, int y, const int* xs, const int* ys, int n, int width, int height, int* out);
+    static void squaredDistances(int x, int y, const int* xs, const int* ys, int n, int width, int height, int* out, blitKernel kernel);
+    static void setKernel(blitKernel kernel);
+    static void setCheck(bool check);
+    static unsigned long getCheckedBlocks();
+};
+
+//*****************************************************************************
+// ***************************** RENDERED OBJECT ******************************
+//*****************************************************************************
+// Vue de rendu d'une entite : la simulation est dans speciesTable.
+// Aucun appel virtuel a l'image : ground::drawObjects connait l'espece de
+// chaque table et appelle update sur le type exact (voir updateViews)
+class renderedObject
 {
 protected:
-    std::map<std::string, std::vector<SDL_Surface*>> images_;
-    int frameDuration_;//Durée de la frame actuelle
-    int frameInterval_;//Nombre d'appelle de update avant d'updateImage
-    int frameIndex_;
-    
-    void setSurfaceMap();
-    virtual std::map<std::string, std::vector<std::string>> getPathMap() = 0;
-    virtual std::string getImageKey() = 0;
+    SDL_Surface* window_surface_ptr_;
+    SDL_Surface* image_ptr_;
 
 public:
-    animatedObject(int frameDuration);
+    renderedObject(const std::string& file_path, SDL_Surface* window_surface_ptr);
+    virtual ~renderedObject() = default;//Seul point virtuel : delete depuis speciesTable::views_
 
-    void updateFrameDuration();
-    void nextFrame();
-    virtual void update() = 0;
+    bool isRendered();//false en mode headless (pas de surface)
+    void draw(int x, int y, spriteBatch& batch);
+    void update(speciesTable& pTable, int i, spriteBatch& batch);//Ajoute l'entite i de pTable a batch
 };
 
 //*****************************************************************************
 // ********************************* SHEPERD **********************************
 //*****************************************************************************
-class shepherd : public movingObject
+class shepherd : public renderedObject
 {
 private:
+    static objectPool<shepherd> pool_;
+
+public:
     static int ImgW;
     static int ImgH;
-    void move();
 
-public:
     shepherd(SDL_Surface* window_surface_ptr);
-
-    void update();
+    static void* operator new(size_t size);//Dans pool_
+    static void operator delete(void* place);
 };
 
 //*****************************************************************************
 // ************************************ DOG ***********************************
 //*****************************************************************************
-class dog : public movingObject
+class dog : public renderedObject
 {
 private:
-    int xTarget_;
-    int yTarget_;
+    static objectPool<dog> pool_;
+
+public:
     static int ImgW;
     static int ImgH;
-    
-public:
+
     dog(SDL_Surface* window_surface_ptr);
+    static void* operator new(size_t size);//Dans pool_
+    static void operator delete(void* place);
 
-    void setXTarget(int x);
-    void setYTarget(int y);
-    void updateTarget();
-    void update();
-    void move();
+    void update(speciesTable& pTable, int i, spriteBatch& batch);
 };
 
 //*****************************************************************************
 // ********************************** SHEEP **********************************
 //*****************************************************************************
-class sheep : public animatedObject, public movingObject
+// Aucun objet par mouton : l'image affichee est choisie par ground::animate, pour
+// tous les moutons a la fois, depuis speciesTable::frame_ et l'animationTable
+class sheep
 {
-private:
-    int cooldown_;
-    int boostTime_;
-    int procreateTime_;
+public:
     static int ImgW;
     static int ImgH;
+    static int FrameInterval;
 
-    std::string getImageKey();
-    std::map<std::string, std::vector<std::string>> getPathMap();
-   
-public:
-    sheep(SDL_Surface* window_surface_ptr, int x, int y);
-    sheep(SDL_Surface* window_surface_ptr);
-    
-    void updateProcreateTime();
-    void updateBoostTime();
-    void update();
-    void move();
+    static std::vector<std::vector<std::string>> getPaths();//Par direction
 };
 
 //*****************************************************************************
 // **********************************  WOLF ***********************************
 //*****************************************************************************
-class wolf: public animatedObject,public movingObject
+// Anime comme sheep, sans objet par loup
+class wolf
 {
-private:
-    int preyDistance_;
-    int lifeTime_;
+public:
     static int ImgW;
     static int ImgH;
+    static int FrameInterval;
+
+    static std::vector<std::vector<std::string>> getPaths();//Par direction
+};
+
+//*****************************************************************************
+// ******************************* SPATIAL GRID *******************************
+//*****************************************************************************
+// Grille uniforme : chaque case contient les index des entites dont le coin
+// haut gauche de la hitbox est dans la case
+class spatialGrid
+{
+private:
+    int cellSize_;
+    int columns_;
+    int rows_;
+    std::vector<std::vector<int>> cells_;
+
+    int getColumn(int x);
+    int getRow(int y);
+
+public:
+    spatialGrid(int cellSize, int width, int height);
+
+    void clear();
+    void insert(int index, int x, int y);
+    void query(int xMin, int yMin, int xMax, int yMax, std::vector<int>& out);//Ajoute a out
+    void queryRing(int x, int y, int ring, std::vector<int>& out);//Cases a ring cases de (x,y)
+    int getCellSize();
+    int getMaxRing();
+};
+
+//*****************************************************************************
+// ****************************** LEVEL OF DETAIL *****************************
+//*****************************************************************************
+// Le monde est decoupe en regions. Pres d'un berger (que la camera suit) ou d'un
+// loup, une region est active : ses moutons sont mis a jour a chaque tick. Loin
+// de tout, elle dort : ses moutons ne sont mis a jour qu'un tick sur lodPeriod,
+// d'un pas de lodPeriod ticks. Reveil immediat, mise en sommeil sur un rayon plus
+// grand et apres lod_demote_ticks ticks calmes : pas de va-et-vient a la frontiere.
+// La camera libre (WASD) ne reveille rien : elle n'est ni dans les instantanes ni
+// dans les enregistrements, et un replay ou un run headless doit retrouver les
+// memes regions actives. Une region dormante a l'ecran avance donc par pas de
+// lodPeriod ticks ; --lod 1 garde tout le monde a chaque tick
+constexpr int lod_chunk_size = 512; // Side of a chunk in pixel
+constexpr int lod_shepherd_radius = 2; // Chunks around a shepherd woken up (Chebyshev distance)
+constexpr int lod_wolf_radius = 1; // Chunks around a wolf woken up
+constexpr int lod_demote_ticks = 60; // Quiet ticks before an active chunk goes dormant
+constexpr int lod_max_period = 16; // Upper bound of simulationParams::lodPeriod
+
+class chunkMap
+{
+private:
+    int columns_;
+    int rows_;
+    std::vector<uint8_t> near_;//Par region ce tick : 2 a reveiller, 1 a garder active
+
+    void mark(int x, int y, int radius);
+
+public:
+    std::vector<uint32_t> active_;//1 : mise a jour a chaque tick
+    std::vector<uint32_t> quiet_;//Ticks consecutifs sans raison d'etre active
+
+    chunkMap(int width, int height);
+    int size();
+    int getChunk(int x, int y);
+    void update(speciesTable& pShepherds, speciesTable& pWolves);//Une fois par tick, avant les mises a jour
+    int getStep(int chunk, uint64_t tick, int period);//Ticks a simuler ce tick : 0, 1 ou period
+};
+
+//*****************************************************************************
+// ******************************** TIMER WHEEL *******************************
+//*****************************************************************************
+// Roue hierarchique : une echeance proche est rangee dans la case de son tick,
+// une lointaine dans une case plus grossiere d'un niveau superieur, redescendue
+// quand la roue y arrive. Un tick ne visite que sa case : un timer qui attend
+// ne coute rien. Les echeances repoussees ne sont pas retirees, fireTimers
+// ignore celles qui ne correspondent plus a la colonne de l'entite
+constexpr int timer_wheel_bits = 8; // 256 slots per level
+constexpr int timer_wheel_levels = 3; // 2^24 ticks, later deadlines wait in the last level
+
+enum class timerKind : uint32_t
+{
+    boostReady, boostEnd, procreateReady, starve
+};
+
+struct timerEvent
+{
+    uint64_t tick_;
+    uint32_t id_;//id_ de l'entite, stable quand removeDeads deplace les index
+    timerKind kind_;
+};
+
+class timerWheel
+{
+private:
+    uint64_t now_;//Dernier tick avance
+    std::vector<std::vector<timerEvent>> slots_;//timer_wheel_levels niveaux de 2^timer_wheel_bits cases
+
+    void insert(const timerEvent& pEvent);
+
+public:
+    timerWheel();
 
-    std::string getImageKey();
-    std::map<std::string, std::vector<std::string>> getPathMap();
+    void reset(uint64_t now);//Vide la roue
+    void schedule(uint64_t tick, uint32_t id, timerKind kind);//Au plus tot au prochain tick
+    void advance(uint64_t tick, std::vector<timerEvent>& out);//Echeances jusqu'a tick, triees par id_
+    size_t size();
+};
+
+//*****************************************************************************
+// ******************************** CHECKPOINT ********************************
+//*****************************************************************************
+// Fichier binaire versionne : un en-tete, puis pour chaque espece un en-tete de
+// table et ses colonnes brutes (32 ou 64 bits, alignees sur 8 octets), lisibles
+// directement depuis le fichier projete en memoire
+constexpr char checkpoint_magic[8] = { 'W', 'O', 'L', 'F', 'S', 'H', 'P', 0 };
+constexpr uint32_t checkpoint_version = 8;
+constexpr uint32_t checkpoint_byte_order = 0x01020304; // Written natively, rejected if swapped
+constexpr int checkpoint_max_pending = 2; // Snapshots waiting for the writer, later ones are skipped
+
+struct checkpointHeader
+{
+    char magic_[8];
+    uint32_t version_;
+    uint32_t byteOrder_;
+    uint64_t size_;//Taille totale du fichier
+    uint32_t nextId_;
+    uint32_t tableCount_;
+    int32_t worldWidth_;//Doit etre celui du ground qui recharge
+    int32_t worldHeight_;
+    uint32_t chunkCount_;//Etat des regions (chunkMap) apres les tables
+    int32_t lodPeriod_;//Doit etre celui du ground qui recharge, comme le monde
+    uint64_t births_;//Compteurs de populationStats depuis le debut de la partie
+    uint64_t kills_;
+    uint64_t starvations_;
+};
+
+struct checkpointTable
+{
+    uint32_t count_;//Entites
+    uint32_t columnCount_;
+    int32_t width_;
+    int32_t height_;
+    int32_t totalVelocity_;
+    uint32_t padding_;
+    uint64_t seed_;
+    uint64_t tick_;
+};
+
+// Ecrit les instantanes deja serialises sur un thread a part : le tick ne fait
+// que la copie memoire. Chaque fichier est ecrit a cote puis renomme
+class checkpointWriter
+{
+private:
+    std::thread thread_;//Demarre au premier instantane
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable idle_;
+    std::deque<std::pair<std::string, std::vector<char>>> queue_;
+    bool writing_;
+    bool stop_;
+
+    void work();
 
 public:
-    wolf(SDL_Surface* window_surface_ptr, int x, int y);
-    wolf(SDL_Surface* window_surface_ptr);
+    checkpointWriter();
+    ~checkpointWriter();//Termine les ecritures en attente
 
-    void choosePrey(renderedObject* pO2);
-    void updateLifeTime();
-    void update();
-    void move();
+    bool push(const std::string& path, std::vector<char>&& data);//false si trop d'instantanes en attente
+    void wait();//Bloque jusqu'a ce que tout soit ecrit
+};
+
+//*****************************************************************************
+// ********************************* TELEMETRY ********************************
+//*****************************************************************************
+constexpr int telemetry_ring_size = 4096; // Records waiting for the writer, power of two
+constexpr uint32_t telemetry_version = 1;
+
+// Population a un tick. Les evenements sont des totaux depuis le debut :
+// la difference entre deux enregistrements donne ceux de l'intervalle
+struct populationStats
+{
+    uint64_t tick_;
+    uint32_t sheep_;
+    uint32_t wolves_;
+    uint64_t births_;
+    uint64_t kills_;//Moutons manges
+    uint64_t starvations_;//Loups morts de faim
+};
+
+// File sans verrou a un producteur et un consommateur : push et pop ne
+// bloquent jamais, push echoue si la file est pleine
+template <class T, int N>
+class spscRing
+{
+    static_assert((N & (N - 1)) == 0, "spscRing size must be a power of two");
+
+private:
+    T items_[N];
+    alignas(64) std::atomic<uint64_t> head_{ 0 };//Prochain a lire, avance par le consommateur
+    alignas(64) std::atomic<uint64_t> tail_{ 0 };//Prochain a ecrire, avance par le producteur
+
+public:
+    bool push(const T& item)
+    {
+        uint64_t vTail = this->tail_.load(std::memory_order_relaxed);
+        if (vTail - this->head_.load(std::memory_order_acquire) >= (uint64_t)N)
+            return false;
+        this->items_[vTail & (N - 1)] = item;
+        this->tail_.store(vTail + 1, std::memory_order_release);
+        return true;
+    }
+    bool pop(T& item)
+    {
+        uint64_t vHead = this->head_.load(std::memory_order_relaxed);
+        if (vHead == this->tail_.load(std::memory_order_acquire))
+            return false;
+        item = this->items_[vHead & (N - 1)];
+        this->head_.store(vHead + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+// Ecrit les populationStats en CSV, ou en binaire si le fichier finit par .bin
+// (en-tete "WSTELEM", version, taille d'un enregistrement, puis les structures)
+class telemetryWriter
+{
+private:
+    spscRing<populationStats, telemetry_ring_size> ring_;
+    std::thread thread_;
+    std::atomic<bool> stop_;
+    std::atomic<uint64_t> dropped_;//File pleine : enregistrement perdu plutot qu'attendre
+    FILE* file_;
+    bool binary_;
+
+    void work();
+    void write(const populationStats& pStats);
+
+public:
+    telemetryWriter(const std::string& path);
+    ~telemetryWriter();//Vide la file puis ferme le fichier
+
+    void push(const populationStats& pStats);//Jamais bloquant
+    uint64_t getDropped();
+};
+
+//*****************************************************************************
+// ********************************* INPUT LOG ********************************
+//*****************************************************************************
+// Fleches du berger, un bit chacune (ground::setKeys)
+constexpr uint8_t key_left = 1;
+constexpr uint8_t key_right = 2;
+constexpr uint8_t key_up = 4;
+constexpr uint8_t key_down = 8;
+constexpr uint32_t input_log_version = 2;
+
+// Une entree, appliquee juste avant le tick tick_ + 1
+struct inputEvent
+{
+    uint64_t tick_;
+    char type_;//'K' : nouvel etat des fleches (a_), 'C' : clic en (a_, b_)
+    int a_;
+    int b_;
+};
+
+// Tout ce qu'il faut pour rejouer une partie : graine, population de depart,
+// entrees datees au tick, et l'etat final attendu. Fichier texte :
+//   wolfsheep-input 1 / seed S / sheep N / wolves N / [restore file] /
+//   K tick keys / C tick x y / end tick hash
+class inputLog
+{
+public:
+    uint64_t seed_;
+    unsigned sheep_;
+    unsigned wolves_;
+    int worldWidth_;
+    int worldHeight_;
+    int lodPeriod_;//simulationParams::lodPeriod
+    std::string restore_;//Instantane de depart, vide si aucun
+    std::vector<inputEvent> events_;//Ticks croissants (verifie par load et application::setReplay)
+    uint64_t endTick_;
+    uint64_t endHash_;//entityStore::getHash au dernier tick
+
+    inputLog();
+    void save(const std::string& path);
+    void load(const std::string& path);
 };
 
 //*****************************************************************************
@@ -203,23 +799,93 @@ public:
 //*****************************************************************************
 class ground 
 {
+    friend class groundBench;//bench.cpp
+
 private:
     SDL_Surface* window_surface_ptr_;
     SDL_Surface* image_ptr_;
-    shepherd* shepherd_;
-    std::vector<movingObject*> movingObjects_;
+    SDL_Surface* background_;//Herbe composee une fois, copiee sous les sprites a effacer
+    std::vector<SDL_Rect> drawnRects_;//Sprites dessines a l'image precedente
+    std::vector<SDL_Rect> dirtyRects_;//Zones modifiees par cette image
+    spriteBatch batch_;//Sprites de l'image en cours
+    checkpointWriter writer_;
+    populationStats stats_;//Evenements comptes par removeDeads et addNews
+    simulationParams params_;
+    uint8_t keys_;//Fleches tenues pendant ce tick (key_left...)
+    bool fullRedraw_;//Prochaine image : tout le fond (premiere image, fenetre exposee)
+    bool presentAll_;//Cette image : trop de zones, on presente toute la fenetre
+    int cameraX_;//Coin haut gauche de la fenetre dans le monde
+    int cameraY_;
+    bool cameraFollow_;//Centree sur le berger, sinon deplacee au clavier (panCamera)
+    int panX_;//Deplacement demande depuis la derniere image
+    int panY_;
+    bool gridsValid_;//Grilles a jour avec store_ : reconstruites apres chaque pas et a la demande
+    entityStore store_;//Etat courant, lu pendant le tick
+    entityStore next_;//Etat suivant, ecrit pendant le tick puis echange
+    spatialGrid preyGrid_;//Reconstruites a chaque tick depuis store_
+    spatialGrid wolfGrid_;
+    spatialGrid dogGrid_;
+    std::vector<int> mates_;//Partenaire de chaque mouton ce tick, -1 si aucun
+    chunkMap chunks_;//Niveau de detail des regions, suit les bergers et les loups
+    timerWheel timers_;//Echeances des colonnes cooldown_, boostTime_, procreateTime_ et lifeTime_
+    std::vector<timerEvent> fired_;//Echeances de ce tick (fireTimers)
+    std::vector<std::vector<timerEvent>> newTimers_;//Echeances posees pendant les mises a jour, une liste par thread de pool_
+    std::vector<int> sheepSteps_;//Ticks simules pour chaque mouton ce tick (chunkMap::getStep)
+    std::vector<int> visible_;//Index des entites d'une espece dans la fenetre (drawObjects)
+    const animationTable* sheepAnimation_;//NULL en headless
+    const animationTable* wolfAnimation_;
+    threadPool pool_;
+
+    void buildGrids();
+    void queryVisible(spatialGrid& pGrid, speciesTable& pTable, std::vector<int>& out);//Entites dans la fenetre
+    void animate(speciesTable& pTable, const std::vector<int>& pIndices, const animationTable& pAnimation);//Avance et dessine
+    void updateCamera();
+    void findMates();
+    void updateSheep(int i, int dt = 1);
+    void updateWolf(int i);
+    void updateShepherds();
+    void updateDogs();
+    int spawn(speciesTable& pTable, int x, int y, uint32_t properties, renderedObject* view);
+    renderedObject* newView(speciesTable& pTable);//NULL en headless et pour les especes animees (sheep, wolf)
+    int findNearestPrey(int pWolf, int& distance);//-1 si aucune, distance au carre
+    int trackPrey(int i);//Proie gardee d'un tick a l'autre, -1 si aucune
+    void updateBoostTime(int i);
+    void updateProcreateTime(int i);
+    void updateLifeTime(int i);
+    void scheduleTimer(uint64_t tick, uint32_t id, timerKind kind);//Depuis les mises a jour paralleles, sans verrou
+    void fireTimers();//Fin du tick, seules les entites dont une echeance tombe
+    void scheduleTimers();//Reconstruit timers_ depuis les colonnes (loadCheckpoint)
+    void updateTarget(int i);
 
 public:
-    ground(SDL_Surface* window_surface_ptr);
-    ~ground() = default;
-    void addMovingObject(movingObject* pO);
-    bool update();//true si quit
+    ground(SDL_Surface* window_surface_ptr, int nThreads = 0, uint64_t seed = 0, const simulationParams& params = simulationParams());
+    ~ground();
+    void addSheep(int x, int y);
+    void addSheep();//Position aleatoire
+    void addWolf();
+    void addDog();
+    void addShepherd();
+    void step();//Un pas de simulation
+    void render();//Efface les sprites precedents, dessine les nouveaux
+    void present(SDL_Window* window_ptr);//Envoie a l'ecran les zones modifiees par render
     void updateObjects();
     void removeDeads();
     void addNews();
     void drawGround();
-    bool mouseEvents();//true si quit
+    void drawObjects();
+    bool mouseEvents(std::vector<SDL_Point>& clicks);//Ajoute les clics a clicks, true si quit
+    void click(int x, int y);//Selectionne un chien, ou envoie le chien selectionne en (x, y), dans le monde
+    SDL_Point toWorld(const SDL_Point& pScreen);//Position d'un clic dans le monde
+    void panCamera(int dx, int dy);//Camera libre
+    void followShepherd();
+    void setKeys(uint8_t keys);//Pour les prochains ticks
     int getScore();
+    populationStats getStats();
+    uint64_t getTick();
+    entityStore& getStore();
+    bool saveCheckpoint(const std::string& path);//Asynchrone, false si l'ecrivain est deborde
+    void loadCheckpoint(const std::string& path);//Remplace tout l'etat
+    void waitCheckpoints();
 };
 
 //*****************************************************************************
@@ -232,9 +898,30 @@ private:
     SDL_Surface* window_surface_ptr_;
     SDL_Event window_event_;
     ground* g_;
+    bool headless_;//Pas de fenetre, pas de rendu, pas de SDL_Delay
+    unsigned checkpointEvery_;//Ticks entre deux instantanes, 0 : aucun
+    std::string checkpointPrefix_;
+    std::unique_ptr<telemetryWriter> telemetry_;//NULL : pas de telemetrie
+    unsigned telemetryEvery_;
+    inputLog log_;//Enregistrement en cours, ou partie rejouee
+    std::string recordPath_;//Vide : pas d'enregistrement
+    bool replay_;
+    size_t replayNext_;//Prochaine entree a rejouer
+    uint8_t keys_;//Dernier etat des fleches enregistre
+
+    void step();
+    void applyClicks(const std::vector<SDL_Point>& clicks);
+    void moveCamera();//Clavier, une fois par image affichee
+    int replay();//Sans attente jusqu'au tick final, puis compare l'etat
+    void close();//Ecrit l'enregistrement, attend les instantanes
 
 public:
-    application(unsigned n_sheep, unsigned n_wolf); // Ctor
+    application(unsigned n_sheep, unsigned n_wolf, bool headless = false, int n_threads = 0, uint64_t seed = 0, const simulationParams& params = simulationParams()); // Ctor
     ~application() = default;                       // dtor
     int loop(unsigned period);  
+    void setCheckpoints(unsigned every, const std::string& prefix);//prefix_<tick>.ckpt
+    void restore(const std::string& path);
+    void setTelemetry(const std::string& path, unsigned every);//.csv ou .bin
+    void setRecord(const std::string& path, const std::string& restore);
+    void setReplay(const inputLog& log);
 };
\ No newline at end of file
@@ -0,0 +1,419 @@
+// batch.cpp : balayage de parametres, des milliers de simulations independantes sur tous les coeurs
+//   batch sweep.txt [--threads N] [--seed N] [--out results.csv] [--runs-out runs.csv]
+// Le fichier de balayage contient une ligne par parametre :
+//   sheep = 50,100,200        liste de valeurs
+//   wolfLifeTime = 300:700:100 debut:fin:pas (fin incluse)
+//   seeds = 20                repetitions de chaque combinaison (graine de base + numero)
+//   ticks = 2000              duree de chaque simulation
+// Une ligne par combinaison dans results.csv, une ligne par simulation dans runs.csv
+#include "Project_SDL1.h"
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+namespace
+{
+    double now()
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Parametres reglables par nom ; sheep et wolves ne sont pas dans simulationParams
+    struct sweepKey
+    {
+        const char* name_;
+        int simulationParams::*field_;
+    };
+
+    const sweepKey sweep_keys[] = {
+        { "sheepVelocity", &simulationParams::sheepVelocity },
+        { "wolfVelocity", &simulationParams::wolfVelocity },
+        { "dogVelocity", &simulationParams::dogVelocity },
+        { "shepherdVelocity", &simulationParams::shepherdVelocity },
+        { "wolfLifeTime", &simulationParams::wolfLifeTime },
+        { "boostCooldown", &simulationParams::boostCooldown },
+        { "boostTime", &simulationParams::boostTime },
+        { "boostSpeed", &simulationParams::boostSpeed },
+        { "procreateTime", &simulationParams::procreateTime },
+        { "dogScareDistance", &simulationParams::dogScareDistance },
+        { "wolfFleeDistance", &simulationParams::wolfFleeDistance },
+        { "dogFollowDistance", &simulationParams::dogFollowDistance },
+        { "worldWidth", &simulationParams::worldWidth },
+        { "worldHeight", &simulationParams::worldHeight },
+        { "lodPeriod", &simulationParams::lodPeriod },
+    };
+
+    struct sweepAxis
+    {
+        std::string name_;
+        std::vector<int> values_;
+    };
+
+    struct sweepSpec
+    {
+        std::vector<sweepAxis> axes_;//Dans l'ordre du fichier
+        int seeds_ = 1;
+        int ticks_ = 1000;
+    };
+
+    // Une combinaison de valeurs, une par axe
+    struct sweepPoint
+    {
+        int sheep_ = 100;
+        int wolves_ = 10;
+        simulationParams params_;
+    };
+
+    struct runResult
+    {
+        populationStats stats_;//Au dernier tick
+        int64_t sheepExtinct_;//Tick de disparition des moutons, -1 s'ils ont survecu
+        int64_t wolvesExtinct_;
+        double seconds_;
+    };
+
+    std::string trim(const std::string& s)
+    {
+        size_t vBegin = s.find_first_not_of(" \t\r");
+        if (vBegin == std::string::npos)
+            return "";
+        return s.substr(vBegin, s.find_last_not_of(" \t\r") - vBegin + 1);
+    }
+
+    std::vector<int> parseValues(const std::string& pText)
+    {
+        std::vector<int> vValues;
+        std::stringstream vStream(pText);
+        std::string vItem;
+        while (std::getline(vStream, vItem, ','))
+        {
+            vItem = trim(vItem);
+            size_t vColon = vItem.find(':');
+            if (vColon == std::string::npos)
+            {
+                vValues.push_back(std::stoi(vItem));
+                continue;
+            }
+            size_t vColon2 = vItem.find(':', vColon + 1);
+            if (vColon2 == std::string::npos)
+                throw std::runtime_error("Range must be start:stop:step : " + vItem + "\n");
+            int vStart = std::stoi(vItem.substr(0, vColon));
+            int vStop = std::stoi(vItem.substr(vColon + 1, vColon2 - vColon - 1));
+            int vStep = std::stoi(vItem.substr(vColon2 + 1));
+            if (vStep <= 0 || vStop < vStart)
+                throw std::runtime_error("Empty range : " + vItem + "\n");
+            for (int v = vStart; v <= vStop; v += vStep)
+                vValues.push_back(v);
+        }
+        if (vValues.empty())
+            throw std::runtime_error("No value in " + pText + "\n");
+        return vValues;
+    }
+
+    sweepSpec loadSpec(const std::string& path)
+    {
+        std::ifstream vFile(path);
+        if (!vFile)
+            throw std::runtime_error("Cannot open sweep file " + path + "\n");
+        sweepSpec vSpec;
+        std::string vLine;
+        while (std::getline(vFile, vLine))
+        {
+            vLine = trim(vLine.substr(0, vLine.find('#')));
+            if (vLine.empty())
+                continue;
+            size_t vEqual = vLine.find('=');
+            if (vEqual == std::string::npos)
+                throw std::runtime_error("Expected key = values : " + vLine + "\n");
+            std::string vKey = trim(vLine.substr(0, vEqual));
+            std::vector<int> vValues = parseValues(vLine.substr(vEqual + 1));
+            if (vKey == "seeds" || vKey == "ticks")
+            {
+                if (vValues.size() != 1 || vValues[0] < 1)
+                    throw std::runtime_error(vKey + " takes one positive value\n");
+                (vKey == "seeds" ? vSpec.seeds_ : vSpec.ticks_) = vValues[0];
+                continue;
+            }
+            bool vKnown = vKey == "sheep" || vKey == "wolves";
+            for (const sweepKey& k : sweep_keys)
+                vKnown = vKnown || vKey == k.name_;
+            if (!vKnown)
+                throw std::runtime_error("Unknown sweep key " + vKey + "\n");
+            vSpec.axes_.push_back({ vKey, vValues });
+        }
+        return vSpec;
+    }
+
+    void setValue(sweepPoint& pPoint, const std::string& pName, int pValue)
+    {
+        if (pName == "sheep")
+            pPoint.sheep_ = pValue;
+        else if (pName == "wolves")
+            pPoint.wolves_ = pValue;
+        else
+            for (const sweepKey& k : sweep_keys)
+                if (pName == k.name_)
+                    pPoint.params_.*k.field_ = pValue;
+    }
+
+    // Produit cartesien des axes, le dernier axe varie le plus vite
+    std::vector<sweepPoint> expand(const sweepSpec& pSpec)
+    {
+        std::vector<sweepPoint> vPoints(1);
+        for (const sweepAxis& vAxis : pSpec.axes_)
+        {
+            std::vector<sweepPoint> vNext;
+            vNext.reserve(vPoints.size() * vAxis.values_.size());
+            for (const sweepPoint& vPoint : vPoints)
+                for (int vValue : vAxis.values_)
+                {
+                    vNext.push_back(vPoint);
+                    setValue(vNext.back(), vAxis.name_, vValue);
+                }
+            vPoints.swap(vNext);
+        }
+        for (const sweepPoint& vPoint : vPoints)
+            vPoint.params_.validate();//Avant de lancer quoi que ce soit
+        return vPoints;
+    }
+
+    runResult runOne(const sweepPoint& pPoint, uint64_t seed, int ticks)
+    {
+        double vStart = now();
+        ground g(NULL, 1, seed, pPoint.params_);//Un seul thread : le parallelisme est entre les simulations
+        for (int i = 0; i < pPoint.sheep_; i++)
+            g.addSheep();
+        for (int i = 0; i < pPoint.wolves_; i++)
+            g.addWolf();
+        g.addShepherd();
+        g.addDog();
+        runResult vResult = { {}, -1, -1, 0. };
+        for (int t = 0; t < ticks; t++)
+        {
+            g.step();
+            populationStats vStats = g.getStats();
+            if (vStats.sheep_ == 0 && vResult.sheepExtinct_ < 0)
+                vResult.sheepExtinct_ = (int64_t)vStats.tick_;
+            if (vStats.wolves_ == 0 && vResult.wolvesExtinct_ < 0)
+                vResult.wolvesExtinct_ = (int64_t)vStats.tick_;
+            if (vStats.sheep_ == 0 && vStats.wolves_ == 0)
+                break;//Plus rien ne peut changer
+        }
+        vResult.stats_ = g.getStats();
+        vResult.seconds_ = now() - vStart;
+        return vResult;
+    }
+} // namespace
+
+//*****************************************************************************
+// **************************** WORK STEALING POOL ****************************
+//*****************************************************************************
+// Chaque worker recoit un bloc contigu de taches et le consomme par la fin ;
+// quand il est vide il vole par le debut le bloc d'un autre. Les taches sont
+// longues (une simulation entiere), un verrou par file suffit
+class workStealingPool
+{
+private:
+    struct workQueue
+    {
+        std::mutex mutex_;
+        std::deque<int> tasks_;
+    };
+
+    std::vector<workQueue> queues_;
+
+    bool pop(int worker, int& task)
+    {
+        workQueue& vOwn = this->queues_[worker];
+        std::lock_guard<std::mutex> vLock(vOwn.mutex_);
+        if (vOwn.tasks_.empty())
+            return false;
+        task = vOwn.tasks_.back();
+        vOwn.tasks_.pop_back();
+        return true;
+    }
+
+    bool steal(int worker, int& task)
+    {
+        int n = (int)this->queues_.size();
+        for (int k = 1; k < n; k++)
+        {
+            workQueue& vVictim = this->queues_[(worker + k) % n];
+            std::lock_guard<std::mutex> vLock(vVictim.mutex_);
+            if (vVictim.tasks_.empty())
+                continue;
+            task = vVictim.tasks_.front();
+            vVictim.tasks_.pop_front();
+            return true;
+        }
+        return false;
+    }
+
+public:
+    workStealingPool(int nThreads) :
+        queues_(nThreads > 0 ? nThreads : std::max(1u, std::thread::hardware_concurrency()))
+    {
+    }
+
+    int getThreadCount() { return (int)this->queues_.size(); }
+
+    // Bloquant ; aucune tache n'est ajoutee pendant l'execution, donc un
+    // worker qui ne trouve rien nulle part peut s'arreter
+    void run(int nTasks, const std::function<void(int task)>& job)
+    {
+        int n = (int)this->queues_.size();
+        for (int w = 0; w < n; w++)
+            for (int i = nTasks * w / n; i < nTasks * (w + 1) / n; i++)
+                this->queues_[w].tasks_.push_back(i);
+        auto vWork = [&](int worker) {
+            int vTask;
+            while (this->pop(worker, vTask) || this->steal(worker, vTask))
+                job(vTask);
+        };
+        std::vector<std::thread> vThreads;
+        for (int w = 1; w < n; w++)
+            vThreads.push_back(std::thread(vWork, w));
+        vWork(0);
+        for (std::thread& t : vThreads)
+            t.join();
+    }
+};
+
+//*****************************************************************************
+// ********************************** OUTPUT **********************************
+//*****************************************************************************
+namespace
+{
+    void writeHeader(std::ostream& pOut, const sweepSpec& pSpec)
+    {
+        for (const sweepAxis& vAxis : pSpec.axes_)
+            pOut << vAxis.name_ << ",";
+    }
+
+    void writePoint(std::ostream& pOut, const sweepSpec& pSpec, const sweepPoint& pPoint)
+    {
+        for (const sweepAxis& vAxis : pSpec.axes_)
+        {
+            if (vAxis.name_ == "sheep")
+                pOut << pPoint.sheep_ << ",";
+            else if (vAxis.name_ == "wolves")
+                pOut << pPoint.wolves_ << ",";
+            else
+                for (const sweepKey& k : sweep_keys)
+                    if (vAxis.name_ == k.name_)
+                        pOut << pPoint.params_.*k.field_ << ",";
+        }
+    }
+
+    // Une passe sur les resultats : runs d'une meme combinaison consecutifs
+    void writeResults(std::ostream& pOut, const sweepSpec& pSpec, const std::vector<sweepPoint>& pPoints, const std::vector<runResult>& pRuns)
+    {
+        writeHeader(pOut, pSpec);
+        pOut << "runs,sheep_mean,sheep_min,sheep_max,wolves_mean,wolves_min,wolves_max,"
+                "sheep_extinct_rate,wolves_extinct_rate,births_mean,kills_mean,starvations_mean\n";
+        int vSeeds = pSpec.seeds_;
+        for (size_t p = 0; p < pPoints.size(); p++)
+        {
+            double vSheep = 0, vWolves = 0, vBirths = 0, vKills = 0, vStarvations = 0;
+            uint32_t vSheepMin = UINT32_MAX, vSheepMax = 0, vWolvesMin = UINT32_MAX, vWolvesMax = 0;
+            int vSheepExtinct = 0, vWolvesExtinct = 0;
+            for (int s = 0; s < vSeeds; s++)
+            {
+                const runResult& r = pRuns[p * vSeeds + s];
+                vSheep += r.stats_.sheep_;
+                vWolves += r.stats_.wolves_;
+                vSheepMin = std::min(vSheepMin, r.stats_.sheep_);
+                vSheepMax = std::max(vSheepMax, r.stats_.sheep_);
+                vWolvesMin = std::min(vWolvesMin, r.stats_.wolves_);
+                vWolvesMax = std::max(vWolvesMax, r.stats_.wolves_);
+                vSheepExtinct += r.sheepExtinct_ >= 0;
+                vWolvesExtinct += r.wolvesExtinct_ >= 0;
+                vBirths += r.stats_.births_;
+                vKills += r.stats_.kills_;
+                vStarvations += r.stats_.starvations_;
+            }
+            writePoint(pOut, pSpec, pPoints[p]);
+            pOut << vSeeds << "," << vSheep / vSeeds << "," << vSheepMin << "," << vSheepMax << ","
+                 << vWolves / vSeeds << "," << vWolvesMin << "," << vWolvesMax << ","
+                 << (double)vSheepExtinct / vSeeds << "," << (double)vWolvesExtinct / vSeeds << ","
+                 << vBirths / vSeeds << "," << vKills / vSeeds << "," << vStarvations / vSeeds << "\n";
+        }
+    }
+
+    void writeRuns(std::ostream& pOut, const sweepSpec& pSpec, const std::vector<sweepPoint>& pPoints, const std::vector<runResult>& pRuns, uint64_t seed)
+    {
+        writeHeader(pOut, pSpec);
+        pOut << "seed,ticks,sheep,wolves,births,kills,starvations,sheep_extinct_tick,wolves_extinct_tick,seconds\n";
+        for (size_t i = 0; i < pRuns.size(); i++)
+        {
+            const runResult& r = pRuns[i];
+            writePoint(pOut, pSpec, pPoints[i / pSpec.seeds_]);
+            pOut << seed + i % pSpec.seeds_ << "," << r.stats_.tick_ << "," << r.stats_.sheep_ << "," << r.stats_.wolves_ << ","
+                 << r.stats_.births_ << "," << r.stats_.kills_ << "," << r.stats_.starvations_ << ","
+                 << r.sheepExtinct_ << "," << r.wolvesExtinct_ << "," << r.seconds_ << "\n";
+        }
+    }
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+        throw std::runtime_error("Usage : batch sweep.txt [--threads N] [--seed N] [--out results.csv] [--runs-out runs.csv]\n");
+    std::string vSpecPath = argv[1];
+    int vThreads = 0;
+    uint64_t vSeed = 1;
+    std::string vOut = "";
+    std::string vRunsOut = "";
+    for (int i = 2; i < argc; i++)
+    {
+        std::string vArg = argv[i];
+        if (vArg == "--threads" && i + 1 < argc)
+            vThreads = std::stoi(argv[++i]);
+        else if (vArg == "--seed" && i + 1 < argc)
+            vSeed = std::stoull(argv[++i]);
+        else if (vArg == "--out" && i + 1 < argc)
+            vOut = argv[++i];
+        else if (vArg == "--runs-out" && i + 1 < argc)
+            vRunsOut = argv[++i];
+        else
+            throw std::runtime_error("Unknown option " + vArg + "\n");
+    }
+    init(true);
+
+    sweepSpec vSpec = loadSpec(vSpecPath);
+    std::vector<sweepPoint> vPoints = expand(vSpec);
+    int vRunCount = (int)vPoints.size() * vSpec.seeds_;
+    std::vector<runResult> vRuns(vRunCount);//Chaque run ecrit sa case, pas de verrou
+
+    workStealingPool vPool(vThreads);
+    fprintf(stderr, "%zu combinations x %d seeds = %d runs of %d ticks on %d threads\n",
+            vPoints.size(), vSpec.seeds_, vRunCount, vSpec.ticks_, vPool.getThreadCount());
+    std::atomic<int> vDone{ 0 };
+    double vStart = now();
+    vPool.run(vRunCount, [&](int i) {
+        vRuns[i] = runOne(vPoints[i / vSpec.seeds_], vSeed + i % vSpec.seeds_, vSpec.ticks_);
+        int vCount = ++vDone;
+        if (vCount % std::max(1, vRunCount / 20) == 0 || vCount == vRunCount)
+            fprintf(stderr, "\r%d / %d runs", vCount, vRunCount);
+    });
+    double vSeconds = now() - vStart;
+    fprintf(stderr, "\n%d runs in %.2fs (%.1f runs/s)\n", vRunCount, vSeconds, vRunCount / std::max(vSeconds, 1e-9));
+
+    if (vOut.empty())
+        writeResults(std::cout, vSpec, vPoints, vRuns);
+    else
+    {
+        std::ofstream vFile(vOut);
+        writeResults(vFile, vSpec, vPoints, vRuns);
+    }
+    if (!vRunsOut.empty())
+    {
+        std::ofstream vFile(vRunsOut);
+        writeRuns(vFile, vSpec, vPoints, vRuns, vSeed);
+    }
+    SDL_Quit();
+    return 0;
+}
@@ -0,0 +1,435 @@
+// bench.cpp : micro et macro benchmarks de la simulation, resultats en JSON
+//   bench [--max-population N] [--ticks N] [--seconds S] [--threads N] [--seed N] [--out file.json]
+// Le JSON va sur la sortie standard (ou --out), la progression sur stderr
+#include "Project_SDL1.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <numeric>
+#include <sstream>
+#include <string>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#include <sys/resource.h>
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    volatile long long sink = 0;//Empeche le compilateur de supprimer les boucles mesurees
+
+    double now()
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    long peakRssKb()
+    {
+#ifdef _WIN32
+        PROCESS_MEMORY_COUNTERS vCounters;
+        GetProcessMemoryInfo(GetCurrentProcess(), &vCounters, sizeof(vCounters));
+        return (long)(vCounters.PeakWorkingSetSize / 1024);
+#else
+        struct rusage vUsage;
+        getrusage(RUSAGE_SELF, &vUsage);
+#ifdef __APPLE__
+        return vUsage.ru_maxrss / 1024;
+#else
+        return vUsage.ru_maxrss;
+#endif
+#endif
+    }
+
+    // Memoire residente a cet instant, pour mesurer un scenario seul (peakRssKb couvre tout le processus)
+    long currentRssKb()
+    {
+#ifdef _WIN32
+        PROCESS_MEMORY_COUNTERS vCounters;
+        GetProcessMemoryInfo(GetCurrentProcess(), &vCounters, sizeof(vCounters));
+        return (long)(vCounters.WorkingSetSize / 1024);
+#elif defined(__APPLE__)
+        mach_task_basic_info_data_t vInfo;
+        mach_msg_type_number_t vCount = MACH_TASK_BASIC_INFO_COUNT;
+        if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&vInfo, &vCount) != KERN_SUCCESS)
+            return 0;
+        return (long)(vInfo.resident_size / 1024);
+#else
+        long vPages = 0;
+        long vResident = 0;
+        FILE* vFile = fopen("/proc/self/statm", "r");
+        if (vFile == NULL)
+            return 0;
+        if (fscanf(vFile, "%ld %ld", &vPages, &vResident) != 2)
+            vResident = 0;
+        fclose(vFile);
+        return vResident * (sysconf(_SC_PAGESIZE) / 1024);
+#endif
+    }
+
+    struct benchOptions
+    {
+        int maxPopulation = 1000000;
+        int ticks = 100;//Maximum par scenario
+        double seconds = 5.;//Budget par scenario
+        int threads = 0;
+        uint64_t seed = 1;
+        std::string out = "";
+    };
+
+    // nSheep moutons, nWolf loups, un berger et un chien
+    void populate(ground& g, int nSheep, int nWolf)
+    {
+        for (int i = 0; i < nSheep; i++)
+            g.addSheep();
+        for (int i = 0; i < nWolf; i++)
+            g.addWolf();
+        g.addShepherd();
+        g.addDog();
+    }
+} // namespace
+
+//*****************************************************************************
+// ******************************* GROUND BENCH *******************************
+//*****************************************************************************
+// Acces aux etapes privees de ground
+class groundBench
+{
+private:
+    std::ostringstream micro_;
+    bool first_ = true;
+
+    void report(const std::string& name, double seconds, long long operations)
+    {
+        double vNs = seconds * 1e9 / std::max(1LL, operations);
+        fprintf(stderr, "%-28s %12.2f ns/op  (%lld ops)\n", name.c_str(), vNs, operations);
+        this->micro_ << (this->first_ ? "" : ",\n") << "    {\"name\": \"" << name << "\", \"ns_per_op\": " << vNs
+                     << ", \"operations\": " << operations << "}";
+        this->first_ = false;
+    }
+
+public:
+    std::string getMicro() { return this->micro_.str(); }
+
+    void run(const benchOptions& pOptions)
+    {
+        const int vSheep = 10000;
+        const int vRepeat = 20;
+        ground g(NULL, pOptions.threads, pOptions.seed);
+        populate(g, vSheep, vSheep / 100);
+        speciesTable& vSheeps = g.store_.sheeps_;
+        speciesTable& vWolves = g.store_.wolves_;
+        int n = vSheeps.size();
+
+        //speciesTable::getDistance (ex renderedObject::getDistance)
+        double vStart = now();
+        long long vSum = 0;
+        for (int r = 0; r < vRepeat; r++)
+            for (int i = 0; i < n; i++)
+                vSum += vSheeps.getDistance(i, vSheeps, (i * 7 + r + 1) % n);
+        this->report("getDistance", now() - vStart, (long long)vRepeat * n);
+        //distanceKernel : une entite contre toutes les autres, par noyau
+        std::vector<int> vXs(n), vYs(n), vOut(n);
+        for (int i = 0; i < n; i++)
+        {
+            vXs[i] = vSheeps.getXBox(i);
+            vYs[i] = vSheeps.getYBox(i);
+        }
+        for (const char* vName : { "scalar", "sse2", "avx2" })
+        {
+            blitKernel vKernel = spriteBatch::parseKernel(vName);
+            if (!spriteBatch::isSupported(vKernel))
+                continue;
+            vStart = now();
+            for (int r = 0; r < vRepeat; r++)
+            {
+                distanceKernel::squaredDistances(vXs[r], vYs[r], vXs.data(), vYs.data(), n, vSheeps.getWidthBox(), vSheeps.getHeightBox(), vOut.data(), vKernel);
+                vSum += vOut[r + 1];
+            }
+            this->report(std::string("squaredDistances.") + vName, now() - vStart, (long long)vRepeat * n);
+        }
+        //speciesTable::theresOverlap
+        vStart = now();
+        for (int r = 0; r < vRepeat; r++)
+            for (int i = 0; i < n; i++)
+                vSum += vSheeps.theresOverlap(i, vSheeps, (i * 7 + r + 1) % n);
+        this->report("theresOverlap", now() - vStart, (long long)vRepeat * n);
+        //speciesTable::adjustVelocitys, sur une copie
+        speciesTable vCopy = vSheeps;
+        vStart = now();
+        for (int r = 0; r < vRepeat; r++)
+            for (int i = 0; i < n; i++)
+            {
+                vCopy.xVelocity_[i] = 40 - r;
+                vCopy.yVelocity_[i] = r - 40;
+                vCopy.adjustVelocitys(i);
+                vSum += vCopy.xVelocity_[i];
+            }
+        this->report("adjustVelocitys", now() - vStart, (long long)vRepeat * n);
+        sink = vSum;
+
+        //Interactions d'une entite (ex movingObject::interact) : updateSheep / updateWolf
+        g.buildGrids();
+        g.next_ = g.store_;
+        g.sheepSteps_.assign(n, 1);
+        g.findMates();
+        vStart = now();
+        for (int i = 0; i < n; i++)
+            g.updateSheep(i);
+        this->report("interact.sheep", now() - vStart, n);
+        vStart = now();
+        for (int i = 0; i < vWolves.size(); i++)
+            g.updateWolf(i);
+        this->report("interact.wolf", now() - vStart, vWolves.size());
+
+        //ground::updateObjects, par entite
+        int vEntities = vSheeps.size() + vWolves.size();
+        vStart = now();
+        for (int r = 0; r < 5; r++)
+            g.updateObjects();
+        this->report("updateObjects", now() - vStart, 5LL * vEntities);
+
+        //ground::removeDeads : un mouton sur dix meurt
+        double vTotal = 0;
+        long long vRemoved = 0;
+        for (int r = 0; r < vRepeat; r++)
+        {
+            entityStore vSaved = g.store_;
+            for (int i = 0; i < g.store_.sheeps_.size(); i += 10)
+                g.store_.sheeps_.addPropertie(i, propertie::dead);
+            vRemoved += g.store_.sheeps_.size();
+            vStart = now();
+            g.removeDeads();
+            vTotal += now() - vStart;
+            g.store_ = vSaved;
+        }
+        this->report("removeDeads", vTotal, vRemoved);
+
+        //ground::addNews : une brebis sur dix met bas
+        vTotal = 0;
+        long long vScanned = 0;
+        for (int r = 0; r < vRepeat; r++)
+        {
+            entityStore vSaved = g.store_;
+            for (int i = 0; i < g.store_.sheeps_.size(); i += 10)
+                g.store_.sheeps_.addPropertie(i, propertie::pregnant);
+            vScanned += g.store_.sheeps_.size();
+            vStart = now();
+            g.addNews();
+            vTotal += now() - vStart;
+            g.store_ = vSaved;
+        }
+        this->report("addNews", vTotal, vScanned);
+
+        //Creation d'entite (ex constructeurs de sheep / wolf)
+        ground vEmpty(NULL, 1, pOptions.seed);
+        vStart = now();
+        for (int i = 0; i < 100000; i++)
+            vEmpty.addSheep();
+        this->report("addSheep", now() - vStart, 100000);
+
+        //timerWheel : 100000 echeances en attente, un tick ne visite que sa case
+        timerWheel vWheel;
+        std::vector<timerEvent> vFired;
+        for (uint32_t i = 0; i < 100000; i++)
+            vWheel.schedule(1 + i % 20000, i, timerKind::starve);
+        vStart = now();
+        for (uint64_t t = 1; t <= 20000; t++)
+        {
+            vWheel.advance(t, vFired);
+            vSum += vFired.size();
+        }
+        this->report("timerWheel.advance", now() - vStart, 20000);
+        sink = vSum;
+
+        //ground::drawGround sur une surface hors ecran (besoin de media/)
+        SDL_Surface* vSurface = SDL_CreateRGBSurfaceWithFormat(0, frame_width, frame_height, 32, SDL_PIXELFORMAT_ARGB8888);
+        try
+        {
+            ground vDrawn(vSurface, 1, pOptions.seed);
+            vStart = now();
+            for (int r = 0; r < 200; r++)
+            {
+                vDrawn.fullRedraw_ = true;
+                vDrawn.drawGround();
+            }
+            this->report("drawGround.full", now() - vStart, 200);
+            //Image complete par rectangles sales, scene clairsemee
+            populate(vDrawn, 100, 1);
+            vDrawn.render();
+            vStart = now();
+            for (int r = 0; r < 200; r++)
+            {
+                vDrawn.step();
+                vDrawn.render();
+            }
+            this->report("step+render.dirty", now() - vStart, 200);
+            //Collage de 1000 sprites par noyau
+            populate(vDrawn, 900, 0);
+            for (const char* vName : { "sdl", "scalar", "sse2", "avx2" })
+            {
+                blitKernel vKernel = spriteBatch::parseKernel(vName);
+                if (!spriteBatch::isSupported(vKernel))
+                    continue;
+                spriteBatch::setKernel(vKernel);
+                vStart = now();
+                for (int r = 0; r < 50; r++)
+                    vDrawn.drawObjects();
+                this->report(std::string("drawObjects.") + vName, now() - vStart, 50);
+            }
+            spriteBatch::setKernel(spriteBatch::getBestKernel());
+            //Tuiles en parallele contre un seul thread, 5000 sprites. Sans second
+            //thread, les tuiles seraient la mesure serie une deuxieme fois
+            int vTileThreads = pOptions.threads > 0 ? pOptions.threads : (int)std::thread::hardware_concurrency();
+            std::vector<int> vThreadCounts = { 1 };
+            if (vTileThreads > 1)
+                vThreadCounts.push_back(vTileThreads);
+            for (int vThreads : vThreadCounts)
+            {
+                ground vTiled(vSurface, vThreads, pOptions.seed);
+                populate(vTiled, 5000, 50);
+                vTiled.drawObjects();
+                vStart = now();
+                for (int r = 0; r < 20; r++)
+                    vTiled.drawObjects();
+                this->report(vThreads == 1 ? "drawObjects.5000.serial" : "drawObjects.5000.tiles", now() - vStart, 20);
+            }
+            //Animation seule : compteurs d'image et choix dans animationTable
+            ground vAnimated(vSurface, 1, pOptions.seed);
+            populate(vAnimated, 5000, 0);
+            std::vector<int> vAll(vAnimated.store_.sheeps_.size());
+            std::iota(vAll.begin(), vAll.end(), 0);
+            vStart = now();
+            for (int r = 0; r < 200; r++)
+            {
+                vAnimated.batch_.clear();
+                vAnimated.animate(vAnimated.store_.sheeps_, vAll, *vAnimated.sheepAnimation_);
+            }
+            this->report("animate.sheep", now() - vStart, 200LL * (long long)vAll.size());
+            //Monde de 32768 de cote : seuls les sprites de la fenetre coutent
+            simulationParams vLarge;
+            vLarge.worldWidth = world_max_size;
+            vLarge.worldHeight = world_max_size;
+            ground vCulled(vSurface, pOptions.threads, pOptions.seed, vLarge);
+            populate(vCulled, 200000, 2000);
+            vCulled.render();
+            vStart = now();
+            for (int r = 0; r < 50; r++)
+                vCulled.drawObjects();
+            this->report("drawObjects.200000.culled", now() - vStart, 50);
+        }
+        catch (const std::exception& e)
+        {
+            fprintf(stderr, "drawGround skipped : %s\n", e.what());
+        }
+        SDL_FreeSurface(vSurface);
+    }
+};
+
+//*****************************************************************************
+// ********************************** MACRO ***********************************
+//*****************************************************************************
+namespace
+{
+    // Scenarios de 100 a maxPopulation moutons : ticks/s, ns par entite et par tick, et
+    // memoire residente du scenario (rss_kb a la fin, rss_added_kb depuis sa creation).
+    // Le monde grandit avec la population (densite de 100 moutons dans la fenetre,
+    // jusqu'a world_max_size) : si un scenario depasse son budget des le premier
+    // tick, les suivants (10 fois plus peuples) sont notes comme sautes
+    std::string runMacro(const benchOptions& pOptions)
+    {
+        std::ostringstream vJson;
+        bool vFirst = true;
+        bool vSkip = false;
+        for (int vPopulation = 100; vPopulation <= pOptions.maxPopulation; vPopulation *= 10)
+        {
+            //Un loup pour cent moutons
+            int vWolves = std::max(1, vPopulation / 100);
+            double vScale = std::sqrt(vPopulation / 100.);
+            simulationParams vParams;
+            vParams.worldWidth = std::min(world_max_size, std::max((int)frame_width, (int)(frame_width * vScale)));
+            vParams.worldHeight = std::min(world_max_size, std::max((int)frame_height, (int)(frame_height * vScale)));
+            vJson << (vFirst ? "" : ",\n") << "    {\"sheep\": " << vPopulation << ", \"wolves\": " << vWolves
+                  << ", \"world\": [" << vParams.worldWidth << ", " << vParams.worldHeight << "]";
+            vFirst = false;
+            if (vSkip)
+            {
+                fprintf(stderr, "%8d sheep %6d wolves %5dx%-5d : skipped\n", vPopulation, vWolves, vParams.worldWidth, vParams.worldHeight);
+                vJson << ", \"skipped\": true}";
+                continue;
+            }
+            long vRssBefore = currentRssKb();
+            ground g(NULL, pOptions.threads, pOptions.seed, vParams);
+            double vStart = now();
+            populate(g, vPopulation, vWolves);
+            double vSetup = now() - vStart;
+            long long vEntityTicks = 0;
+            int vTicks = 0;
+            vStart = now();
+            while (vTicks < pOptions.ticks && now() - vStart < pOptions.seconds)
+            {
+                entityStore& vStore = g.getStore();
+                vEntityTicks += vStore.sheeps_.size() + vStore.wolves_.size() + vStore.dogs_.size() + vStore.shepherds_.size();
+                g.step();
+                vTicks++;
+            }
+            double vSeconds = now() - vStart;
+            double vTicksPerSecond = vTicks / vSeconds;
+            double vNsPerEntityTick = vSeconds * 1e9 / std::max(1LL, vEntityTicks);
+            vSkip = vTicks == 1 && vSeconds > pOptions.seconds;
+            long vRssAfter = currentRssKb();//Ground encore vivant
+            fprintf(stderr, "%8d sheep %6d wolves %5dx%-5d : %10.1f ticks/s %10.1f ns/entity-tick  (%d ticks, setup %.2fs)\n",
+                    vPopulation, vWolves, vParams.worldWidth, vParams.worldHeight, vTicksPerSecond, vNsPerEntityTick, vTicks, vSetup);
+            vJson << ", \"ticks\": " << vTicks << ", \"seconds\": " << vSeconds
+                  << ", \"ticks_per_sec\": " << vTicksPerSecond << ", \"ns_per_entity_tick\": " << vNsPerEntityTick
+                  << ", \"final_sheep\": " << g.getScore() << ", \"rss_kb\": " << vRssAfter << ", \"rss_added_kb\": " << vRssAfter - vRssBefore << "}";
+        }
+        return vJson.str();
+    }
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    benchOptions vOptions;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string vArg = argv[i];
+        if (vArg == "--max-population" && i + 1 < argc)
+            vOptions.maxPopulation = std::stoi(argv[++i]);
+        else if (vArg == "--ticks" && i + 1 < argc)
+            vOptions.ticks = std::stoi(argv[++i]);
+        else if (vArg == "--seconds" && i + 1 < argc)
+            vOptions.seconds = std::stod(argv[++i]);
+        else if (vArg == "--threads" && i + 1 < argc)
+            vOptions.threads = std::stoi(argv[++i]);
+        else if (vArg == "--seed" && i + 1 < argc)
+            vOptions.seed = std::stoull(argv[++i]);
+        else if (vArg == "--out" && i + 1 < argc)
+            vOptions.out = argv[++i];
+        else
+            throw std::runtime_error("Unknown option " + vArg + "\n");
+    }
+    init(true);
+    IMG_Init(IMG_INIT_PNG);//Pour drawGround
+
+    groundBench vBench;
+    vBench.run(vOptions);
+    std::string vMacro = runMacro(vOptions);
+
+    std::ostringstream vJson;
+    vJson << "{\n  \"threads\": " << (vOptions.threads > 0 ? vOptions.threads : (int)std::thread::hardware_concurrency()) << ",\n  \"seed\": " << vOptions.seed
+          << ",\n  \"micro\": [\n" << vBench.getMicro() << "\n  ],\n  \"macro\": [\n" << vMacro
+          << "\n  ],\n  \"peak_rss_kb\": " << peakRssKb() << "\n}\n";
+    if (vOptions.out.empty())
+        std::cout << vJson.str();
+    else
+        std::ofstream(vOptions.out) << vJson.str();
+    spriteAtlas::release();
+    SDL_Quit();
+    return 0;
+}
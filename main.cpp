@@ -1,33 +1,139 @@
 #include "Project_SDL1.h"
 #include <stdio.h>
+#include <random>
 #include <string>
+#ifdef _WIN32
 #include <windows.h>
+#endif
 int main(int argc, char* argv[]) {
 
 
     std::cout << "Starting up the application" << std::endl;
 
-    if (argc != 4)
+    if (argc < 4)
     throw std::runtime_error("Need three arguments - "
                                 "number of sheep, number of wolves, "
-                                "simulation time\n");
+                                "simulation time [--headless] [--threads N] [--seed N] [--trace file.json] "
+                                "[--blitter sdl|scalar|sse2|avx2] [--check-blit] [--distances scalar|sse2|avx2] [--check-distances] "
+                                "[--checkpoint-every TICKS] [--checkpoint-prefix P] [--restore file.ckpt] "
+                                "[--telemetry file.csv|file.bin] [--telemetry-every TICKS] "
+                                "[--record file.input] [--replay file.input] [--world WIDTHxHEIGHT] [--lod TICKS]\n");
 
-    //Initialize SDL , Initialize PNG loading
-    init(); 
+    //La cible SDL_part1_headless est toujours sans fenetre
+#ifdef WOLFSHEEP_HEADLESS
+    bool headless = true;
+#else
+    bool headless = false;
+#endif
+    int threads = 0; // 0 : un thread par coeur
+    uint64_t seed = std::random_device()(); // Affiche pour pouvoir rejouer la partie
+    unsigned checkpointEvery = 0; // 0 : pas d'instantane
+    std::string checkpointPrefix = "checkpoint";
+    std::string restore = ""; // Reprend un instantane a la place de la population initiale
+    std::string telemetry = ""; // Vide : pas de telemetrie
+    unsigned telemetryEvery = 1;
+    std::string record = ""; // Enregistre les entrees de la partie
+    std::string replay = ""; // Rejoue un enregistrement (graine et population comprises)
+    simulationParams params; // Monde de la taille de la fenetre par defaut
+    for (int i = 4; i < argc; i++)
+    {
+        if (std::string(argv[i]) == "--headless")
+            headless = true;
+        else if (std::string(argv[i]) == "--threads" && i + 1 < argc)
+            threads = std::stoi(argv[++i]);
+        else if (std::string(argv[i]) == "--seed" && i + 1 < argc)
+            seed = std::stoull(argv[++i]);
+        else if (std::string(argv[i]) == "--checkpoint-every" && i + 1 < argc)
+            checkpointEvery = std::stoul(argv[++i]);
+        else if (std::string(argv[i]) == "--checkpoint-prefix" && i + 1 < argc)
+            checkpointPrefix = argv[++i];
+        else if (std::string(argv[i]) == "--restore" && i + 1 < argc)
+            restore = argv[++i];
+        else if (std::string(argv[i]) == "--telemetry" && i + 1 < argc)
+            telemetry = argv[++i];
+        else if (std::string(argv[i]) == "--telemetry-every" && i + 1 < argc)
+            telemetryEvery = std::stoul(argv[++i]);
+        else if (std::string(argv[i]) == "--record" && i + 1 < argc)
+            record = argv[++i];
+        else if (std::string(argv[i]) == "--replay" && i + 1 < argc)
+            replay = argv[++i];
+        else if (std::string(argv[i]) == "--world" && i + 1 < argc)
+        {
+            std::string world = argv[++i];
+            size_t x = world.find('x');
+            if (x == std::string::npos)
+                throw std::runtime_error("--world expects WIDTHxHEIGHT\n");
+            params.worldWidth = std::stoi(world.substr(0, x));
+            params.worldHeight = std::stoi(world.substr(x + 1));
+        }
+        else if (std::string(argv[i]) == "--lod" && i + 1 < argc)
+            params.lodPeriod = std::stoi(argv[++i]);//1 : pas de region endormie
+        else if (std::string(argv[i]) == "--blitter" && i + 1 < argc)
+            spriteBatch::setKernel(spriteBatch::parseKernel(argv[++i]));
+        else if (std::string(argv[i]) == "--check-blit")
+            spriteBatch::setCheck(true);//Chaque image comparee a SDL_BlitSurface
+        else if (std::string(argv[i]) == "--distances" && i + 1 < argc)
+            distanceKernel::setKernel(spriteBatch::parseKernel(argv[++i]));
+        else if (std::string(argv[i]) == "--check-distances")
+            distanceKernel::setCheck(true);//Chaque bloc compare au noyau scalaire
+#ifdef WOLFSHEEP_PROFILE
+        else if (std::string(argv[i]) == "--trace" && i + 1 < argc)
+            profiler::setTraceFile(argv[++i]);
+#endif
+        else
+            throw std::runtime_error("Unknown option " + std::string(argv[i]) + "\n");
+    }
 
-    std::cout << "Done with initilization" << std::endl;
+    //Initialize SDL , Initialize PNG loading (timer only when headless)
+    init(headless); 
 
-    auto my_app = application(std::stoul(argv[1]), std::stoul(argv[2]));
+    std::cout << "Done with initilization (seed " << seed << ")" << std::endl;
 
-    std::cout << "Created window" << std::endl;
+    unsigned nSheep = std::stoul(argv[1]);
+    unsigned nWolf = std::stoul(argv[2]);
+    inputLog replayLog;
+    if (!replay.empty())
+    {
+        replayLog.load(replay);
+        seed = replayLog.seed_;
+        nSheep = replayLog.sheep_;
+        nWolf = replayLog.wolves_;
+        params.worldWidth = replayLog.worldWidth_;
+        params.worldHeight = replayLog.worldHeight_;
+        params.lodPeriod = replayLog.lodPeriod_;
+    }
+
+    auto my_app = application(nSheep, nWolf, headless, threads, seed, params);
+
+    std::cout << (headless ? "Running headless" : "Created window") << std::endl;
+
+    my_app.setCheckpoints(checkpointEvery, checkpointPrefix);
+    if (!replay.empty())
+        my_app.setReplay(replayLog);
+    else if (!restore.empty())
+        my_app.restore(restore);
+    if (!record.empty())
+        my_app.setRecord(record, restore);
+    if (!telemetry.empty())
+        my_app.setTelemetry(telemetry, telemetryEvery);
 
     //Debut de la loop
     int retval = my_app.loop(std::stoul(argv[3]));
 
     std::cout << "Exiting application with code " << retval << std::endl;
+    if (spriteBatch::getCheckedFrames() > 0)
+        std::cout << "Blit check : " << spriteBatch::getCheckedFrames() << " frames identical to SDL_BlitSurface" << std::endl;
+    if (distanceKernel::getCheckedBlocks() > 0)
+        std::cout << "Distance check : " << distanceKernel::getCheckedBlocks() << " blocks identical to the scalar reference" << std::endl;
+
+#ifdef WOLFSHEEP_PROFILE
+    profiler::report();
+#endif
 
+    spriteAtlas::release();
     //Nettoyez tous les sous-syst�mes initialis�s.
     SDL_Quit();
-    SDL_Delay(4000);
+    if (!headless)
+        SDL_Delay(4000);
     return retval;
 }
\ No newline at end of file